@@ -0,0 +1,601 @@
+/* Benchmark for regcomp, regexec and re_search.
+
+   Copyright 2017-2025 Dameng Database Co.,Ltd.
+
+   This file is part of the regex library; it is distributed under the
+   same terms (GNU Lesser General Public License version 2.1 or later).
+
+   The benchmark is not part of the library.  It is built by hand together
+   with the library sources, for example:
+
+     gcc -O2 -Iinclude -o regex_bench bench/regex_bench.c \
+	 regcomp.c regexec.c regex_internal.c regex.c
+
+   Each case of a fixed corpus of REGEXP_LIKE/REGEXP_SUBSTR style patterns
+   is timed three ways:
+
+     regcomp    compile and free the pattern repeatedly;
+     regexec    match the pattern against every row of a generated table
+		column, the way REGEXP_LIKE evaluates a predicate;
+     re_search  scan the whole column as one newline separated buffer and
+		find every match, the way REGEXP_SUBSTR/REGEXP_COUNT do.
+
+   For every case the benchmark reports throughput in MB/s, per call
+   latency percentiles and the peak number of bytes the library held
+   through the reg_mem_init hooks.  The numbers are only comparable
+   between builds on the same machine.
+
+   Usage: regex_bench [-s KB] [-r REPEAT] [-c COMPILES] [-f NAME]
+     -s KB        size of each generated corpus (default 1024)
+     -r REPEAT    passes over the corpus for regexec (default 3)
+     -c COMPILES  regcomp calls per case (default 200)
+     -f NAME      only run the cases whose name contains NAME  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include <time.h>
+
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <sys/time.h>
+# include <sys/resource.h>
+#endif
+
+#include "regex.h"
+
+/* Timing.  */
+
+static double
+bench_now_ns (void)
+{
+#ifdef _WIN32
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER now;
+  if (freq.QuadPart == 0)
+    QueryPerformanceFrequency (&freq);
+  QueryPerformanceCounter (&now);
+  return (double) now.QuadPart * 1e9 / (double) freq.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+#endif
+}
+
+/* Memory accounting.  The library allocates through the hooks installed
+   by reg_mem_init; every block carries a small header holding its size
+   so that the current and peak totals can be kept exactly.  */
+
+typedef union
+{
+  size_t size;
+  double align_d;
+  void *align_p;
+  long long align_ll;
+} bench_mem_hdr;
+
+static size_t bench_mem_cur;
+static size_t bench_mem_peak;
+
+static void
+bench_mem_account (size_t add, size_t sub)
+{
+  bench_mem_cur = bench_mem_cur + add - sub;
+  if (bench_mem_cur > bench_mem_peak)
+    bench_mem_peak = bench_mem_cur;
+}
+
+static void *
+bench_malloc (size_t size)
+{
+  bench_mem_hdr *hdr = malloc (sizeof (bench_mem_hdr) + size);
+  if (hdr == NULL)
+    return NULL;
+  hdr->size = size;
+  bench_mem_account (size, 0);
+  return hdr + 1;
+}
+
+static void *
+bench_realloc (void *ptr, size_t size)
+{
+  bench_mem_hdr *hdr;
+  size_t old_size;
+
+  if (ptr == NULL)
+    return bench_malloc (size);
+  hdr = (bench_mem_hdr *) ptr - 1;
+  old_size = hdr->size;
+  hdr = realloc (hdr, sizeof (bench_mem_hdr) + size);
+  if (hdr == NULL)
+    return NULL;
+  hdr->size = size;
+  bench_mem_account (size, old_size);
+  return hdr + 1;
+}
+
+static void
+bench_free (void *ptr)
+{
+  bench_mem_hdr *hdr;
+
+  if (ptr == NULL)
+    return;
+  hdr = (bench_mem_hdr *) ptr - 1;
+  bench_mem_account (0, hdr->size);
+  free (hdr);
+}
+
+static void *
+bench_calloc (int size, size_t n)
+{
+  void *ptr = bench_malloc ((size_t) size * n);
+  if (ptr != NULL)
+    memset (ptr, 0, (size_t) size * n);
+  return ptr;
+}
+
+/* Corpus.  Three columns are generated: plain ASCII order rows, and the
+   same rows with Chinese city names and comments encoded in UTF-8 and in
+   GB18030.  Rows are produced by a fixed LCG so that every run sees the
+   same data.  */
+
+enum bench_corpus
+{
+  CORPUS_ASCII,
+  CORPUS_UTF8,
+  CORPUS_GB18030,
+  CORPUS_NUM
+};
+
+/* DM charset codes understood by reg_set_locale.  */
+static const int bench_corpus_charset[CORPUS_NUM] = { -1, 1, 0 };
+static const char *const bench_corpus_name[CORPUS_NUM] =
+  { "ascii", "utf8", "gb18030" };
+
+typedef struct
+{
+  char *text;		/* All rows separated by '\n'.  */
+  size_t len;
+  char **rows;		/* NUL terminated copies of every row.  */
+  size_t *row_lens;
+  size_t nrows;
+} bench_column;
+
+static unsigned int bench_seed;
+
+static unsigned int
+bench_rand (void)
+{
+  bench_seed = bench_seed * 1103515245u + 12345u;
+  return (bench_seed >> 16) & 0x7fff;
+}
+
+static const char *const ascii_cities[] =
+  { "Beijing", "Shanghai", "Shenzhen", "Guangzhou", "Hangzhou", "Wuhan",
+    "Chengdu", "Nanjing" };
+static const char *const ascii_notes[] =
+  { "paid in full", "PENDING review", "refund requested", "shipped",
+    "Cancelled by customer", "address changed twice", "aabb ccdd",
+    "express delivery" };
+/* "Beijing", "Shanghai", "Wuhan", "Chengdu" and "database" in Chinese.  */
+static const char *const utf8_cities[] =
+  { "\xe5\x8c\x97\xe4\xba\xac", "\xe4\xb8\x8a\xe6\xb5\xb7",
+    "\xe6\xad\xa6\xe6\xb1\x89", "\xe6\x88\x90\xe9\x83\xbd" };
+static const char *const utf8_notes[] =
+  { "\xe6\x95\xb0\xe6\x8d\xae\xe5\xba\x93 ok", "paid",
+    "\xe5\xb7\xb2\xe5\x8f\x91\xe8\xb4\xa7", "PENDING" };
+static const char *const gb_cities[] =
+  { "\xb1\xb1\xbe\xa9", "\xc9\xcf\xba\xa3", "\xce\xe4\xba\xba",
+    "\xb3\xc9\xb6\xbc" };
+static const char *const gb_notes[] =
+  { "\xca\xfd\xbe\xdd\xbf\xe2 ok", "paid", "\xd2\xd1\xb7\xa2\xbb\xf5",
+    "PENDING" };
+
+#define NELEM(a) (sizeof (a) / sizeof ((a)[0]))
+
+static void
+bench_column_build (bench_column *col, enum bench_corpus corpus,
+		    size_t size)
+{
+  size_t alloc = size + 256;
+  size_t nrows_alloc = size / 32 + 16;
+  char row[256];
+
+  col->text = malloc (alloc);
+  col->rows = malloc (nrows_alloc * sizeof (char *));
+  col->row_lens = malloc (nrows_alloc * sizeof (size_t));
+  if (col->text == NULL || col->rows == NULL || col->row_lens == NULL)
+    {
+      fputs ("out of memory\n", stderr);
+      exit (2);
+    }
+  col->len = 0;
+  col->nrows = 0;
+  bench_seed = 20241227u + (unsigned int) corpus;
+
+  while (col->len < size && col->nrows < nrows_alloc)
+    {
+      unsigned int id = bench_rand () * 32768u + bench_rand ();
+      const char *city, *note;
+      int n;
+
+      switch (corpus)
+	{
+	case CORPUS_UTF8:
+	  city = utf8_cities[bench_rand () % NELEM (utf8_cities)];
+	  note = utf8_notes[bench_rand () % NELEM (utf8_notes)];
+	  break;
+	case CORPUS_GB18030:
+	  city = gb_cities[bench_rand () % NELEM (gb_cities)];
+	  note = gb_notes[bench_rand () % NELEM (gb_notes)];
+	  break;
+	default:
+	  city = ascii_cities[bench_rand () % NELEM (ascii_cities)];
+	  note = ascii_notes[bench_rand () % NELEM (ascii_notes)];
+	  break;
+	}
+      n = snprintf (row, sizeof (row),
+		    "ORDER-%07u|user%u@example.%s|20%02u-%02u-%02u|%s|%u.%02u|%s",
+		    id % 10000000u, id % 5000u,
+		    (id & 1) ? "com" : "cn", 10 + bench_rand () % 15,
+		    1 + bench_rand () % 12, 1 + bench_rand () % 28, city,
+		    bench_rand () % 10000, bench_rand () % 100, note);
+      if (n < 0 || (size_t) n >= sizeof (row))
+	continue;
+      if (col->len + n + 1 > alloc)
+	break;
+
+      col->rows[col->nrows] = malloc (n + 1);
+      if (col->rows[col->nrows] == NULL)
+	{
+	  fputs ("out of memory\n", stderr);
+	  exit (2);
+	}
+      memcpy (col->rows[col->nrows], row, n + 1);
+      col->row_lens[col->nrows++] = n;
+      memcpy (col->text + col->len, row, n);
+      col->len += n;
+      col->text[col->len++] = '\n';
+    }
+}
+
+static void
+bench_column_free (bench_column *col)
+{
+  size_t i;
+  for (i = 0; i < col->nrows; ++i)
+    free (col->rows[i]);
+  free (col->rows);
+  free (col->row_lens);
+  free (col->text);
+}
+
+/* Cases.  */
+
+typedef struct
+{
+  const char *name;
+  const char *pattern;
+  int cflags;
+  enum bench_corpus corpus;
+  size_t nmatch;
+} bench_case;
+
+static const bench_case bench_cases[] =
+{
+  { "literal", "Shanghai", REG_EXTENDED, CORPUS_ASCII, 1 },
+  { "literal-miss", "Chongqing", REG_EXTENDED, CORPUS_ASCII, 1 },
+  { "anchored", "^ORDER-00[0-9]+\\|", REG_EXTENDED, CORPUS_ASCII, 1 },
+  { "bracket-date", "20[0-9]{2}-(0[1-9]|1[0-2])-[0-9]{2}", REG_EXTENDED,
+    CORPUS_ASCII, 1 },
+  { "class-email", "[[:alnum:]._]+@[[:alnum:]]+\\.(com|cn)", REG_EXTENDED,
+    CORPUS_ASCII, 3 },
+  { "alternation", "(Beijing|Shanghai|Shenzhen|Guangzhou|Hangzhou|Chongqing)",
+    REG_EXTENDED, CORPUS_ASCII, 2 },
+  { "interval", "\\|[0-9]{3,4}\\.[0-9]{1,2}\\|", REG_EXTENDED,
+    CORPUS_ASCII, 1 },
+  { "interval-wide", "user[0-9]{1,40}@", REG_EXTENDED, CORPUS_ASCII, 1 },
+  { "backref", "([a-z])\\1([a-z])\\2", REG_EXTENDED, CORPUS_ASCII, 3 },
+  { "icase", "pending|cancelled", REG_EXTENDED | REG_ICASE,
+    CORPUS_ASCII, 1 },
+  { "icase-class", "^order-[0-9]+\\|[a-z0-9]+@example\\.COM",
+    REG_EXTENDED | REG_ICASE, CORPUS_ASCII, 1 },
+  { "nosub", "(paid|shipped).*$", REG_EXTENDED | REG_NOSUB,
+    CORPUS_ASCII, 0 },
+  { "eager", "\\|(Beijing|Shanghai|Wuhan)\\|[0-9]+\\.",
+    REG_EXTENDED | REG_DFA_EAGER, CORPUS_ASCII, 2 },
+  { "eager-nosub", "(paid|shipped|cancelled)",
+    REG_EXTENDED | REG_NOSUB | REG_DFA_EAGER, CORPUS_ASCII, 0 },
+  { "utf8-literal", "\xe4\xb8\x8a\xe6\xb5\xb7", REG_EXTENDED,
+    CORPUS_UTF8, 1 },
+  { "utf8-period", "\\|..\\|[0-9]+\\.", REG_EXTENDED, CORPUS_UTF8, 1 },
+  { "utf8-bracket", "[\xe5\x8c\x97\xe4\xb8\x8a][\xe4\xba\xac\xe6\xb5\xb7]",
+    REG_EXTENDED, CORPUS_UTF8, 1 },
+  { "gb18030-literal", "\xc9\xcf\xba\xa3", REG_EXTENDED, CORPUS_GB18030, 1 },
+  { "gb18030-period", "\\|..\\|[0-9]+\\.", REG_EXTENDED, CORPUS_GB18030, 1 },
+};
+
+/* Statistics.  */
+
+typedef struct
+{
+  double *v;
+  size_t n;
+  size_t alloc;
+} bench_samples;
+
+static void
+bench_samples_add (bench_samples *s, double v)
+{
+  if (s->n == s->alloc)
+    {
+      s->alloc = s->alloc ? s->alloc * 2 : 1024;
+      s->v = realloc (s->v, s->alloc * sizeof (double));
+      if (s->v == NULL)
+	{
+	  fputs ("out of memory\n", stderr);
+	  exit (2);
+	}
+    }
+  s->v[s->n++] = v;
+}
+
+static int
+bench_cmp_double (const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+/* Sort the samples and return the P-th percentile (0 <= P <= 1).  Sorting
+   is idempotent, so several percentiles may be read in a row.  */
+static double
+bench_percentile (bench_samples *s, double p)
+{
+  if (s->n == 0)
+    return 0;
+  qsort (s->v, s->n, sizeof (double), bench_cmp_double);
+  return s->v[(size_t) (p * (double) (s->n - 1) + 0.5)];
+}
+
+static double
+bench_mbps (size_t bytes, double ns)
+{
+  return ns > 0 ? (double) bytes / (1024.0 * 1024.0) / (ns / 1e9) : 0;
+}
+
+/* Runners.  */
+
+static int
+bench_regcomp (const bench_case *bc, int ncompiles, bench_samples *lat)
+{
+  int i;
+  for (i = 0; i < ncompiles; ++i)
+    {
+      regex_t re;
+      double t0 = bench_now_ns ();
+      int err = regcomp (&re, bc->pattern, bc->cflags);
+      bench_samples_add (lat, bench_now_ns () - t0);
+      if (err != 0)
+	{
+	  char buf[128];
+	  regerror (err, &re, buf, sizeof (buf));
+	  fprintf (stderr, "%s: regcomp failed: %s\n", bc->name, buf);
+	  return -1;
+	}
+      regfree (&re);
+    }
+  return 0;
+}
+
+static long
+bench_regexec (const bench_case *bc, const bench_column *col, int repeat,
+	       bench_samples *lat, double *total_ns)
+{
+  regex_t re;
+  regmatch_t pmatch[10];
+  long nmatches = 0;
+  int r;
+  size_t i;
+
+  if (regcomp (&re, bc->pattern, bc->cflags) != 0)
+    return -1;
+  *total_ns = 0;
+  for (r = 0; r < repeat; ++r)
+    for (i = 0; i < col->nrows; ++i)
+      {
+	double t0 = bench_now_ns (), dt;
+	int ret = regexec (&re, col->rows[i], bc->nmatch, pmatch, 0);
+	dt = bench_now_ns () - t0;
+	*total_ns += dt;
+	bench_samples_add (lat, dt);
+	if (ret == 0)
+	  ++nmatches;
+      }
+  regfree (&re);
+  return nmatches / repeat;
+}
+
+static long
+bench_re_search (const bench_case *bc, const bench_column *col,
+		 double *total_ns)
+{
+  struct re_pattern_buffer buf;
+  struct re_registers regs;
+  reg_syntax_t syntax;
+  const char *msg;
+  regoff_t pos = 0, len = (regoff_t) col->len;
+  long nmatches = 0;
+  double t0;
+
+  memset (&buf, 0, sizeof (buf));
+  memset (&regs, 0, sizeof (regs));
+  /* regfree releases the fastmap through the hooks as well.  */
+  buf.fastmap = bench_malloc (256);
+  if (buf.fastmap == NULL)
+    return -1;
+  /* Behave like regcomp with REG_NEWLINE: the buffer holds one row per
+     line.  */
+  syntax = (RE_SYNTAX_POSIX_EXTENDED & ~RE_DOT_NEWLINE)
+	   | RE_HAT_LISTS_NOT_NEWLINE;
+  if (bc->cflags & REG_ICASE)
+    syntax |= RE_ICASE;
+  if (bc->cflags & REG_NOSUB)
+    syntax |= RE_NO_SUB;
+  re_set_syntax (syntax);
+  msg = re_compile_pattern (bc->pattern, strlen (bc->pattern), &buf);
+  if (msg != NULL)
+    {
+      fprintf (stderr, "%s: re_compile_pattern failed: %s\n", bc->name, msg);
+      regfree (&buf);
+      return -1;
+    }
+
+  t0 = bench_now_ns ();
+  while (pos <= len)
+    {
+      regoff_t ret = re_search (&buf, col->text, len, pos, len - pos, &regs);
+      if (ret < 0)
+	break;
+      ++nmatches;
+      /* REG_NOSUB leaves the registers alone; step one byte.  */
+      if (!buf.no_sub && regs.num_regs > 0 && regs.end[0] > ret)
+	pos = regs.end[0];
+      else
+	pos = ret + 1;
+    }
+  *total_ns = bench_now_ns () - t0;
+
+  /* The registers were allocated by the library.  */
+  bench_free (regs.start);
+  bench_free (regs.end);
+  regfree (&buf);
+  return nmatches;
+}
+
+static int
+bench_set_locale (enum bench_corpus corpus, int flag)
+{
+  int charset = bench_corpus_charset[corpus];
+  if (charset < 0)
+    return 1;
+  reg_set_locale (charset, flag);
+  /* The library only switches to multibyte matching when the locale took
+     effect; report it so that numbers from different hosts are not
+     mixed up.  */
+  return flag ? (int) MB_CUR_MAX : 1;
+}
+
+int
+main (int argc, char **argv)
+{
+  size_t size = 1024 * 1024;
+  int repeat = 3, ncompiles = 200;
+  const char *filter = NULL;
+  bench_column cols[CORPUS_NUM];
+  size_t i;
+  int ret = 0;
+
+  for (i = 1; i < (size_t) argc; ++i)
+    {
+      if (strcmp (argv[i], "-s") == 0 && i + 1 < (size_t) argc)
+	size = (size_t) atol (argv[++i]) * 1024;
+      else if (strcmp (argv[i], "-r") == 0 && i + 1 < (size_t) argc)
+	repeat = atoi (argv[++i]);
+      else if (strcmp (argv[i], "-c") == 0 && i + 1 < (size_t) argc)
+	ncompiles = atoi (argv[++i]);
+      else if (strcmp (argv[i], "-f") == 0 && i + 1 < (size_t) argc)
+	filter = argv[++i];
+      else
+	{
+	  fprintf (stderr,
+		   "usage: %s [-s KB] [-r REPEAT] [-c COMPILES] [-f NAME]\n",
+		   argv[0]);
+	  return 2;
+	}
+    }
+  if (size == 0 || repeat <= 0 || ncompiles <= 0)
+    {
+      fputs ("sizes and counts must be positive\n", stderr);
+      return 2;
+    }
+
+  reg_mem_init (bench_malloc, bench_realloc, bench_free, bench_calloc);
+  for (i = 0; i < CORPUS_NUM; ++i)
+    bench_column_build (&cols[i], (enum bench_corpus) i, size);
+
+  printf ("%-16s %-7s %3s %9s %9s | %8s %7s %7s %7s %7s | %8s %7s | %10s\n",
+	  "case", "corpus", "mb", "comp-p50", "comp-p99", "exec-MBs",
+	  "p50", "p90", "p99", "match", "srch-MBs", "found", "peak-bytes");
+  printf ("%-16s %-7s %3s %9s %9s | %8s %7s %7s %7s %7s | %8s %7s | %10s\n",
+	  "", "", "", "(us)", "(us)", "", "(ns)", "(ns)", "(ns)", "rows",
+	  "", "", "");
+
+  for (i = 0; i < NELEM (bench_cases); ++i)
+    {
+      const bench_case *bc = &bench_cases[i];
+      const bench_column *col = &cols[bc->corpus];
+      bench_samples comp = { NULL, 0, 0 }, exec = { NULL, 0, 0 };
+      double exec_ns = 0, search_ns = 0;
+      long nexec, nsearch;
+      size_t base;
+      int mb;
+
+      if (filter != NULL && strstr (bc->name, filter) == NULL)
+	continue;
+
+      mb = bench_set_locale (bc->corpus, 1);
+      base = bench_mem_cur;
+      bench_mem_peak = base;
+
+      if (bench_regcomp (bc, ncompiles, &comp) != 0)
+	{
+	  ret = 1;
+	  bench_set_locale (bc->corpus, 0);
+	  free (comp.v);
+	  continue;
+	}
+      nexec = bench_regexec (bc, col, repeat, &exec, &exec_ns);
+      nsearch = bench_re_search (bc, col, &search_ns);
+      if (nexec < 0 || nsearch < 0)
+	ret = 1;
+
+      printf ("%-16s %-7s %3d %9.2f %9.2f | %8.1f %7.0f %7.0f %7.0f %7ld"
+	      " | %8.1f %7ld | %10lu\n",
+	      bc->name, bench_corpus_name[bc->corpus], mb,
+	      bench_percentile (&comp, 0.50) / 1e3,
+	      bench_percentile (&comp, 0.99) / 1e3,
+	      bench_mbps (col->len * repeat, exec_ns),
+	      bench_percentile (&exec, 0.50), bench_percentile (&exec, 0.90),
+	      bench_percentile (&exec, 0.99), nexec,
+	      bench_mbps (col->len, search_ns), nsearch,
+	      (unsigned long) (bench_mem_peak - base));
+      fflush (stdout);
+
+      bench_set_locale (bc->corpus, 0);
+      free (comp.v);
+      free (exec.v);
+    }
+
+  if (bench_mem_cur != 0)
+    {
+      fprintf (stderr, "leaked %lu bytes through reg_mem_init hooks\n",
+	       (unsigned long) bench_mem_cur);
+      ret = 1;
+    }
+#ifndef _WIN32
+  {
+    struct rusage ru;
+    if (getrusage (RUSAGE_SELF, &ru) == 0)
+      printf ("process peak RSS: %ld KB\n", ru.ru_maxrss);
+  }
+#endif
+
+  for (i = 0; i < CORPUS_NUM; ++i)
+    bench_column_free (&cols[i]);
+  return ret;
+}
@@ -0,0 +1,485 @@
+/* Microbenchmarks for the primitives of regex_internal.c.
+
+   Copyright 2017-2025 Dameng Database Co.,Ltd.
+
+   This file is part of the regex library; it is distributed under the
+   same terms (GNU Lesser General Public License version 2.1 or later).
+
+   The program is not part of the library.  It uses the internal
+   interfaces of regex_internal.h, so it must be built with the same
+   preprocessor flags as the library sources, for example:
+
+     gcc -O2 -Iinclude -o regex_micro bench/regex_micro.c \
+	 regcomp.c regexec.c regex_internal.c regex.c
+
+   and with -DHAVE_WCTYPE_H=1 -DHAVE_ISWCTYPE=1 added everywhere to
+   measure the RE_ENABLE_I18N buffers; without them those cases are
+   reported as skipped.
+
+   Measured primitives:
+
+     node-set-insert     re_node_set_insert of shuffled elements
+     node-set-merge      re_node_set_merge of two half overlapping sets
+     node-set-intersect  re_node_set_add_intersect into an empty set
+     node-set-union      re_node_set_init_union of two half overlapping sets
+     state-lookup        re_acquire_state_context hits on the states of a
+			 compiled pattern; calc_state_hash is static and
+			 is measured through it
+     wcs-buffer          build_wcs_buffer over UTF-8 text
+     wcs-upper-buffer    build_wcs_upper_buffer over UTF-8 text
+
+   The node-set cases run at several set sizes.  Every case is repeated
+   and the fastest and the median run are reported, in nanoseconds per
+   set element, lookup or buffer byte, so that two builds can be
+   compared before and after changing a primitive.
+
+   Usage: regex_micro [-n OPS] [-r RUNS] [-f NAME]
+     -n OPS   operations per run (default 200000)
+     -r RUNS  runs per case (default 7)
+     -f NAME  only run the cases whose name contains NAME  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include <time.h>
+
+#ifdef _WIN32
+# include <windows.h>
+#endif
+
+#include "regex_internal.h"
+
+/* Timing.  */
+
+static double
+micro_now_ns (void)
+{
+#ifdef _WIN32
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER now;
+  if (freq.QuadPart == 0)
+    QueryPerformanceFrequency (&freq);
+  QueryPerformanceCounter (&now);
+  return (double) now.QuadPart * 1e9 / (double) freq.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+#endif
+}
+
+static void
+micro_fail (const char *what)
+{
+  fprintf (stderr, "%s failed\n", what);
+  exit (2);
+}
+
+/* Inputs.  */
+
+static unsigned int micro_seed = 1;
+
+static unsigned int
+micro_rand (void)
+{
+  micro_seed = micro_seed * 1103515245u + 12345u;
+  return (micro_seed >> 16) & 0x7fff;
+}
+
+/* Fill SET with SIZE elements: every STEP-th node starting at FIRST, as
+   the node sets of a pattern are sparse and sorted.  */
+
+static void
+micro_make_set (re_node_set *set, Idx size, Idx first, Idx step)
+{
+  Idx i;
+
+  if (re_node_set_alloc (set, size) != REG_NOERROR)
+    micro_fail ("re_node_set_alloc");
+  for (i = 0; i < size; ++i)
+    if (!re_node_set_insert_last (set, first + i * step))
+      micro_fail ("re_node_set_insert_last");
+}
+
+/* A case runs OPS operations at SIZE and returns the elapsed time; the
+   number of units the time is divided by is stored in *UNITS.  */
+
+typedef double (*micro_fn) (Idx size, long ops, double *units);
+
+static volatile Idx micro_sink;
+
+static double
+micro_insert (Idx size, long ops, double *units)
+{
+  Idx *elems = malloc (size * sizeof (Idx));
+  re_node_set set;
+  long done = 0;
+  double t, total = 0;
+  Idx i;
+
+  if (elems == NULL)
+    micro_fail ("malloc");
+  for (i = 0; i < size; ++i)
+    elems[i] = i * 3;
+  for (i = size - 1; i > 0; --i)
+    {
+      Idx j = micro_rand () % (i + 1), tmp = elems[i];
+      elems[i] = elems[j];
+      elems[j] = tmp;
+    }
+
+  while (done < ops)
+    {
+      re_node_set_init_empty (&set);
+      t = micro_now_ns ();
+      for (i = 0; i < size; ++i)
+	if (!re_node_set_insert (&set, elems[i]))
+	  micro_fail ("re_node_set_insert");
+      total += micro_now_ns () - t;
+      micro_sink = set.nelem;
+      re_node_set_free (&set);
+      done += size;
+    }
+  free (elems);
+  *units = done;
+  return total;
+}
+
+static double
+micro_merge (Idx size, long ops, double *units)
+{
+  re_node_set src1, src2, dest;
+  long done = 0;
+  double t0;
+
+  /* SRC2 shares every other element of SRC1.  */
+  micro_make_set (&src1, size, 0, 2);
+  micro_make_set (&src2, size, size, 1);
+  if (re_node_set_alloc (&dest, 2 * size) != REG_NOERROR)
+    micro_fail ("re_node_set_alloc");
+
+  t0 = micro_now_ns ();
+  while (done < ops)
+    {
+      dest.nelem = 0;
+      if (re_node_set_merge (&dest, &src1) != REG_NOERROR
+	  || re_node_set_merge (&dest, &src2) != REG_NOERROR)
+	micro_fail ("re_node_set_merge");
+      micro_sink = dest.nelem;
+      done += 2 * size;
+    }
+  t0 = micro_now_ns () - t0;
+
+  re_node_set_free (&src1);
+  re_node_set_free (&src2);
+  re_node_set_free (&dest);
+  *units = done;
+  return t0;
+}
+
+static double
+micro_intersect (Idx size, long ops, double *units)
+{
+  re_node_set src1, src2, dest;
+  long done = 0;
+  double t0;
+
+  micro_make_set (&src1, size, 0, 2);
+  micro_make_set (&src2, size, size, 1);
+  if (re_node_set_alloc (&dest, size) != REG_NOERROR)
+    micro_fail ("re_node_set_alloc");
+
+  t0 = micro_now_ns ();
+  while (done < ops)
+    {
+      dest.nelem = 0;
+      if (re_node_set_add_intersect (&dest, &src1, &src2) != REG_NOERROR)
+	micro_fail ("re_node_set_add_intersect");
+      micro_sink = dest.nelem;
+      done += 2 * size;
+    }
+  t0 = micro_now_ns () - t0;
+
+  re_node_set_free (&src1);
+  re_node_set_free (&src2);
+  re_node_set_free (&dest);
+  *units = done;
+  return t0;
+}
+
+static double
+micro_union (Idx size, long ops, double *units)
+{
+  re_node_set src1, src2, dest;
+  long done = 0;
+  double total = 0, t;
+
+  micro_make_set (&src1, size, 0, 2);
+  micro_make_set (&src2, size, size, 1);
+
+  while (done < ops)
+    {
+      t = micro_now_ns ();
+      if (re_node_set_init_union (&dest, &src1, &src2) != REG_NOERROR)
+	micro_fail ("re_node_set_init_union");
+      total += micro_now_ns () - t;
+      micro_sink = dest.nelem;
+      re_node_set_free (&dest);
+      done += 2 * size;
+    }
+
+  re_node_set_free (&src1);
+  re_node_set_free (&src2);
+  *units = done;
+  return total;
+}
+
+/* Compile an alternation of SIZE words and scan a subject holding every
+   word, none followed by ';', so that the DFA builds states of many node
+   sets; then look every state up again.  */
+
+static double
+micro_state_lookup (Idx size, long ops, double *units)
+{
+  char *pat = malloc (size * 16 + 8), *text = malloc (size * 16 + 8);
+  char *p = pat, *q = text;
+  re_dfastate_t **states;
+  Idx nstates = 0, i;
+  re_hashval_t b;
+  const re_dfa_t *dfa;
+  long done = 0;
+  regex_t re;
+  double t0;
+
+  if (pat == NULL || text == NULL)
+    micro_fail ("malloc");
+  p += sprintf (p, "(");
+  for (i = 0; i < size; ++i)
+    {
+      p += sprintf (p, "%sw%ld", i ? "|" : "", (long) i * 7);
+      q += sprintf (q, "w%ld ", (long) i * 7);
+    }
+  sprintf (p, ");");
+  if (regcomp (&re, pat, REG_EXTENDED | REG_NOSUB) != 0
+      || regexec (&re, text, 0, NULL, 0) != REG_NOMATCH)
+    micro_fail ("regcomp or regexec");
+  dfa = re.buffer;
+
+  states = malloc (dfa->nstates * sizeof (re_dfastate_t *));
+  if (states == NULL)
+    micro_fail ("malloc");
+  for (b = 0; b <= dfa->state_hash_mask; ++b)
+    if (dfa->state_table[b].state != NULL)
+      states[nstates++] = dfa->state_table[b].state;
+
+  t0 = micro_now_ns ();
+  while (done < ops)
+    {
+      for (i = 0; i < nstates; ++i)
+	{
+	  reg_errcode_t err;
+	  re_dfastate_t *s = re_acquire_state_context (&err, dfa,
+						       states[i]->entrance_nodes,
+						       states[i]->context);
+	  if (s != states[i])
+	    micro_fail ("re_acquire_state_context");
+	}
+      done += nstates;
+    }
+  t0 = micro_now_ns () - t0;
+
+  free (states);
+  regfree (&re);
+  free (pat);
+  free (text);
+  *units = done;
+  return t0;
+}
+
+#ifdef RE_ENABLE_I18N
+/* Rebuild the wide character buffer of SIZE bytes of mixed ASCII and
+   Chinese UTF-8 text.  */
+
+static double
+micro_wcs (Idx size, long ops, double *units, bool icase)
+{
+  /* "database" in Chinese.  */
+  static const char piece[] = "\xe6\x95\xb0\xe6\x8d\xae Order-42 ";
+  char *text = malloc (size + sizeof piece);
+  re_string_t pstr;
+  long done = 0;
+  regex_t re;
+  double t0;
+  Idx len = 0;
+
+  if (text == NULL)
+    micro_fail ("malloc");
+  while (len + (Idx) sizeof piece - 1 <= size)
+    {
+      memcpy (text + len, piece, sizeof piece - 1);
+      len += sizeof piece - 1;
+    }
+  text[len] = '\0';
+  /* A character class keeps optimize_utf8 from switching the DFA to
+     single bytes.  */
+  if (regcomp (&re, "[[:alpha:]]", icase ? REG_ICASE : 0) != 0)
+    micro_fail ("regcomp");
+  if (re_string_construct (&pstr, text, len, NULL, icase, re.buffer)
+      != REG_NOERROR || pstr.wcs == NULL)
+    micro_fail ("re_string_construct");
+
+  t0 = micro_now_ns ();
+  while (done < ops)
+    {
+      pstr.valid_len = pstr.valid_raw_len = 0;
+      memset (&pstr.cur_state, '\0', sizeof (mbstate_t));
+      if (icase)
+	{
+	  if (build_wcs_upper_buffer (&pstr) != REG_NOERROR)
+	    micro_fail ("build_wcs_upper_buffer");
+	}
+      else
+	build_wcs_buffer (&pstr);
+      micro_sink = pstr.valid_len;
+      done += len;
+    }
+  t0 = micro_now_ns () - t0;
+
+  re_string_destruct (&pstr);
+  regfree (&re);
+  free (text);
+  *units = done;
+  return t0;
+}
+
+static double
+micro_wcs_buffer (Idx size, long ops, double *units)
+{
+  return micro_wcs (size, ops, units, false);
+}
+
+static double
+micro_wcs_upper_buffer (Idx size, long ops, double *units)
+{
+  return micro_wcs (size, ops, units, true);
+}
+#else /* !RE_ENABLE_I18N */
+/* Not built in; the cases are reported as skipped.  */
+# define micro_wcs_buffer NULL
+# define micro_wcs_upper_buffer NULL
+#endif /* RE_ENABLE_I18N */
+
+/* Cases.  */
+
+typedef struct
+{
+  const char *name;
+  micro_fn fn;		/* NULL if not built in.  */
+  int utf8;		/* Needs a UTF-8 locale.  */
+  const char *unit;	/* What the time is divided by.  */
+  Idx sizes[4];		/* Set sizes, words or bytes; 0 ends the list.  */
+} micro_case;
+
+static const micro_case micro_cases[] =
+{
+  { "node-set-insert", micro_insert, 0, "elem", { 4, 32, 256, 0 } },
+  { "node-set-merge", micro_merge, 0, "elem", { 4, 32, 256, 0 } },
+  { "node-set-intersect", micro_intersect, 0, "elem", { 4, 32, 256, 0 } },
+  { "node-set-union", micro_union, 0, "elem", { 4, 32, 256, 0 } },
+  { "state-lookup", micro_state_lookup, 0, "lookup", { 8, 64, 0 } },
+  { "wcs-buffer", micro_wcs_buffer, 1, "byte", { 4096, 0 } },
+  { "wcs-upper-buffer", micro_wcs_upper_buffer, 1, "byte", { 4096, 0 } },
+};
+
+#define NELEM(a) (sizeof (a) / sizeof ((a)[0]))
+
+static int
+micro_cmp_double (const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+int
+main (int argc, char **argv)
+{
+  long ops = 200000;
+  int runs = 7, r;
+  const char *filter = NULL;
+  double *ns;
+  size_t i, k;
+
+  for (i = 1; i < (size_t) argc; ++i)
+    {
+      if (strcmp (argv[i], "-n") == 0 && i + 1 < (size_t) argc)
+	ops = atol (argv[++i]);
+      else if (strcmp (argv[i], "-r") == 0 && i + 1 < (size_t) argc)
+	runs = atoi (argv[++i]);
+      else if (strcmp (argv[i], "-f") == 0 && i + 1 < (size_t) argc)
+	filter = argv[++i];
+      else
+	{
+	  fprintf (stderr, "usage: %s [-n OPS] [-r RUNS] [-f NAME]\n",
+		   argv[0]);
+	  return 2;
+	}
+    }
+  if (ops <= 0 || runs <= 0)
+    {
+      fputs ("counts must be positive\n", stderr);
+      return 2;
+    }
+  ns = malloc (runs * sizeof (double));
+  if (ns == NULL)
+    micro_fail ("malloc");
+
+  printf ("%-20s %6s %10s %10s  %s\n", "case", "size", "best", "median",
+	  "unit");
+  for (i = 0; i < NELEM (micro_cases); ++i)
+    {
+      const micro_case *mc = &micro_cases[i];
+
+      if (filter != NULL && strstr (mc->name, filter) == NULL)
+	continue;
+      if (mc->fn == NULL)
+	{
+	  printf ("%-20s skipped: built without RE_ENABLE_I18N\n", mc->name);
+	  continue;
+	}
+      if (mc->utf8)
+	{
+	  reg_set_locale (1, 1);
+	  if (MB_CUR_MAX == 1 && setlocale (LC_ALL, "C.UTF-8") == NULL)
+	    setlocale (LC_ALL, "C.utf8");
+	  if (MB_CUR_MAX == 1)
+	    {
+	      printf ("%-20s skipped: no UTF-8 locale\n", mc->name);
+	      continue;
+	    }
+	}
+
+      for (k = 0; k < NELEM (mc->sizes) && mc->sizes[k] != 0; ++k)
+	{
+	  double units = 1;
+
+	  /* One warm-up run, then RUNS measured ones.  */
+	  mc->fn (mc->sizes[k], ops / 4, &units);
+	  for (r = 0; r < runs; ++r)
+	    ns[r] = mc->fn (mc->sizes[k], ops, &units) / units;
+	  qsort (ns, runs, sizeof (double), micro_cmp_double);
+	  printf ("%-20s %6ld %10.2f %10.2f  ns/%s\n", mc->name,
+		  (long) mc->sizes[k], ns[0], ns[runs / 2], mc->unit);
+	  fflush (stdout);
+	}
+
+      if (mc->utf8)
+	{
+	  reg_set_locale (1, 0);
+	  setlocale (LC_ALL, "C");
+	}
+    }
+
+  free (ns);
+  return 0;
+}
@@ -0,0 +1,565 @@
+/* Regression corpus of pathological patterns.
+
+   Copyright 2017-2025 Dameng Database Co.,Ltd.
+
+   This file is part of the regex library; it is distributed under the
+   same terms (GNU Lesser General Public License version 2.1 or later).
+
+   The program is not part of the library.  It is built by hand together
+   with the library sources, for example:
+
+     gcc -O2 -Iinclude -o regex_patho bench/regex_patho.c \
+	 regcomp.c regexec.c regex_internal.c regex.c -lm
+
+   Every case is a pattern and subject known to be expensive for this
+   engine: back references resolved through get_subexp and check_arrival,
+   long {m,n} expansions in parse_dup_op, wide alternations, REG_ICASE on
+   multibyte text and non-greedy repetitions.  A case is generated at a
+   base size N and at 4N, compiled and matched.  Every measurement
+   repeats the case until it has run for at least PATHO_MIN_MS and
+   takes the mean, so short cases rise well above timer resolution, and
+   the median of PATHO_RUNS measurements is kept.  A case fails when
+
+     - the growth exponent log(T(4N) / T(N)) / log(4) exceeds the
+       recorded one by more than a noise margin, i.e. the case became
+       super-linear (or worse than its known complexity) again;
+     - the time at 4N exceeds its budget;
+     - the peak bytes held through the reg_mem_init hooks at 4N exceed
+       the memory budget;
+     - the match result differs from the recorded one.
+
+   The exit status is 1 when any case failed, so the program can be run
+   before a release.  The budgets are generous on purpose: they catch
+   complexity regressions, not small slowdowns, which regex_bench is
+   for.
+
+   The non-greedy case only exists when RE_ENABLE_NONGREEDY is defined;
+   pass -DRE_ENABLE_NONGREEDY for the library sources too.
+
+   Usage: regex_patho [-x SCALE] [-f NAME] [-v]
+     -x SCALE  multiply every base size by SCALE (default 1); the time
+	       and memory budgets grow as SCALE to the power of the
+	       recorded time and memory exponents
+     -f NAME   only run the cases whose name contains NAME
+     -v        print the timing of every run  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <locale.h>
+#include <math.h>
+#include <time.h>
+
+#ifdef _WIN32
+# include <windows.h>
+#endif
+
+#include "regex.h"
+
+/* Timing.  */
+
+static double
+patho_now_ns (void)
+{
+#ifdef _WIN32
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER now;
+  if (freq.QuadPart == 0)
+    QueryPerformanceFrequency (&freq);
+  QueryPerformanceCounter (&now);
+  return (double) now.QuadPart * 1e9 / (double) freq.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+#endif
+}
+
+/* Memory accounting through the reg_mem_init hooks, as in regex_bench:
+   every block carries a header holding its size.  */
+
+typedef union
+{
+  size_t size;
+  double align_d;
+  void *align_p;
+  long long align_ll;
+} patho_mem_hdr;
+
+static size_t patho_mem_cur;
+static size_t patho_mem_peak;
+
+static void
+patho_mem_account (size_t add, size_t sub)
+{
+  patho_mem_cur = patho_mem_cur + add - sub;
+  if (patho_mem_cur > patho_mem_peak)
+    patho_mem_peak = patho_mem_cur;
+}
+
+static void *
+patho_malloc (size_t size)
+{
+  patho_mem_hdr *hdr = malloc (sizeof (patho_mem_hdr) + size);
+  if (hdr == NULL)
+    return NULL;
+  hdr->size = size;
+  patho_mem_account (size, 0);
+  return hdr + 1;
+}
+
+static void *
+patho_realloc (void *ptr, size_t size)
+{
+  patho_mem_hdr *hdr;
+  size_t old_size;
+
+  if (ptr == NULL)
+    return patho_malloc (size);
+  hdr = (patho_mem_hdr *) ptr - 1;
+  old_size = hdr->size;
+  hdr = realloc (hdr, sizeof (patho_mem_hdr) + size);
+  if (hdr == NULL)
+    return NULL;
+  hdr->size = size;
+  patho_mem_account (size, old_size);
+  return hdr + 1;
+}
+
+static void
+patho_free (void *ptr)
+{
+  patho_mem_hdr *hdr;
+
+  if (ptr == NULL)
+    return;
+  hdr = (patho_mem_hdr *) ptr - 1;
+  patho_mem_account (0, hdr->size);
+  free (hdr);
+}
+
+static void *
+patho_calloc (int size, size_t n)
+{
+  void *ptr = patho_malloc ((size_t) size * n);
+  if (ptr != NULL)
+    memset (ptr, 0, (size_t) size * n);
+  return ptr;
+}
+
+/* Growable strings for the generated patterns and subjects.  */
+
+typedef struct
+{
+  char *s;
+  size_t len;
+  size_t alloc;
+} patho_buf;
+
+static void
+patho_put (patho_buf *b, const char *s)
+{
+  size_t n = strlen (s);
+  if (b->len + n + 1 > b->alloc)
+    {
+      b->alloc = (b->len + n + 1) * 2;
+      b->s = realloc (b->s, b->alloc);
+      if (b->s == NULL)
+	{
+	  fputs ("out of memory\n", stderr);
+	  exit (2);
+	}
+    }
+  memcpy (b->s + b->len, s, n + 1);
+  b->len += n;
+}
+
+static void
+patho_put_rep (patho_buf *b, const char *s, size_t count)
+{
+  while (count-- > 0)
+    patho_put (b, s);
+}
+
+/* Case generators.  Each one builds the pattern and the subject for size
+   N.  */
+
+/* Nested back references on a subject that never matches: every start
+   position reaches check_matching, and get_subexp/check_arrival try
+   every length of the inner group.  The groups are short, so the work
+   per position is bounded and the case must stay linear.  */
+
+static void
+gen_backref_nested (size_t n, patho_buf *pat, patho_buf *text)
+{
+  patho_put (pat, "(a(b*))\\2\\1x");
+  patho_put_rep (text, "ab", n / 2);
+}
+
+/* A back reference to one long group: the back reference cache records a
+   sub-match for every candidate end of the group and check_arrival walks
+   each of them, so time and memory are quadratic in the subject.  */
+
+static void
+gen_backref_long (size_t n, patho_buf *pat, patho_buf *text)
+{
+  patho_put (pat, "^([a-z]+)-\\1$");
+  patho_put_rep (text, "k", n);
+  patho_put (text, "-");
+  patho_put_rep (text, "k", n);
+}
+
+/* A long counted repetition: parse_dup_op copies the operand N times,
+   and the epsilon closures of the optional copies, like the DFA states
+   built from them, hold O(N) nodes each.  Quadratic in N.  */
+
+static void
+gen_dup_expand (size_t n, patho_buf *pat, patho_buf *text)
+{
+  char num[32];
+
+  sprintf (num, "%lu", (unsigned long) n);
+  patho_put (pat, "^(ab|c[0-9]){1,");
+  patho_put (pat, num);
+  patho_put (pat, "}$");
+  patho_put_rep (text, "abc7", n / 2);
+}
+
+/* Nested counted repetitions multiply in parse_dup_op; quadratic in the
+   outer count for the same reason as dup-expand.  */
+
+static void
+gen_dup_nested (size_t n, patho_buf *pat, patho_buf *text)
+{
+  char num[32];
+
+  sprintf (num, "%lu", (unsigned long) n);
+  patho_put (pat, "((x|y){2,8}z){1,");
+  patho_put (pat, num);
+  patho_put (pat, "}!");
+  patho_put_rep (text, "xyxyz", n);
+  patho_put (text, "!");
+}
+
+/* N alternatives of distinct words; the subject holds every word once,
+   but none followed by ';'.  The initial state holds all N branches, and
+   so does every state reached from it: quadratic in N.  */
+
+static void
+gen_alternation (size_t n, patho_buf *pat, patho_buf *text)
+{
+  char word[32];
+  size_t i;
+
+  patho_put (pat, "(");
+  for (i = 0; i < n; ++i)
+    {
+      sprintf (word, "%sw%lu", i ? "|" : "", (unsigned long) i);
+      patho_put (pat, word);
+    }
+  patho_put (pat, ");");
+  for (i = 0; i < n; ++i)
+    {
+      sprintf (word, "w%lu,", (unsigned long) i);
+      patho_put (text, word);
+    }
+}
+
+/* REG_ICASE over UTF-8 text: the multibyte buffer is rebuilt with case
+   folding (build_wcs_upper_buffer) while the matcher restarts at every
+   character.  */
+
+static void
+gen_icase_utf8 (size_t n, patho_buf *pat, patho_buf *text)
+{
+  /* "database" in Chinese, then ASCII letters of either case.  */
+  patho_put (pat, "\xe6\x95\xb0\xe6\x8d\xae[a-z]*OK$");
+  patho_put_rep (text, "\xe6\x95\xb0\xe6\x8d\xae" "AbCdEf ", n / 16);
+}
+
+#ifdef RE_ENABLE_NONGREEDY
+/* A non-greedy repetition searched for every match, the way
+   REGEXP_SUBSTR walks the subject: N tags, each one a match.  */
+
+static void
+gen_nongreedy (size_t n, patho_buf *pat, patho_buf *text)
+{
+  patho_put (pat, "<.+?>");
+  patho_put_rep (text, "<tag attr=1>text ", n);
+}
+#endif
+
+/* Cases.  */
+
+enum patho_run
+{
+  RUN_REGEXEC,		/* One regexec call on the subject.  */
+  RUN_ALL		/* re_search for every match, like REGEXP_SUBSTR.  */
+};
+
+typedef struct
+{
+  const char *name;
+  void (*gen) (size_t n, patho_buf *pat, patho_buf *text);
+  int cflags;
+  int utf8;		/* Needs a UTF-8 locale.  */
+  enum patho_run run;
+  size_t nmatch;
+  size_t n;		/* Base size.  */
+  double exponent;	/* Recorded growth exponent of the time.  */
+  double max_ms;	/* Time budget at 4N.  */
+  double mem_exponent;	/* Growth exponent of the peak bytes.  */
+  double max_bytes;	/* Memory budget at 4N.  */
+  int match;		/* Expected result of RUN_REGEXEC: 1 if it
+			   matches; for RUN_ALL the number of matches per
+			   N.  */
+} patho_case;
+
+#define MB (1024.0 * 1024.0)
+
+static const patho_case patho_cases[] =
+{
+  { "backref-nested", gen_backref_nested, REG_EXTENDED, 0, RUN_REGEXEC,
+    3, 20000, 1.0, 500, 0.0, 8 * MB, 0 },
+  { "backref-long", gen_backref_long, REG_EXTENDED, 0, RUN_REGEXEC,
+    2, 200, 2.0, 500, 2.0, 16 * MB, 1 },
+  { "dup-expand", gen_dup_expand, REG_EXTENDED, 0, RUN_REGEXEC,
+    2, 150, 2.0, 1000, 2.0, 128 * MB, 1 },
+  { "dup-nested", gen_dup_nested, REG_EXTENDED, 0, RUN_REGEXEC,
+    1, 80, 2.0, 2000, 2.0, 128 * MB, 1 },
+  { "alternation", gen_alternation, REG_EXTENDED, 0, RUN_REGEXEC,
+    1, 400, 2.0, 1000, 2.0, 128 * MB, 0 },
+  { "icase-utf8", gen_icase_utf8, REG_EXTENDED | REG_ICASE, 1,
+    RUN_REGEXEC, 1, 50000, 1.0, 1000, 0.0, 16 * MB, 0 },
+#ifdef RE_ENABLE_NONGREEDY
+  { "nongreedy", gen_nongreedy, REG_EXTENDED, 0, RUN_ALL,
+    1, 60000, 1.0, 1000, 0.0, 8 * MB, 1 },
+#endif
+};
+
+#define NELEM(a) (sizeof (a) / sizeof ((a)[0]))
+
+/* The growth exponent may exceed the recorded one by this much before a
+   case fails; timer noise on short runs stays well below it.  */
+#define PATHO_EXPONENT_SLACK 0.5
+
+/* Measurements per size; the median is kept.  Odd, so the median is
+   one of them.  */
+#define PATHO_RUNS 7
+
+/* A measurement repeats the case until it has run this long.  */
+#define PATHO_MIN_MS 50.0
+
+/* Compile and match case PC at size N.  Store the time in *NS and the
+   peak bytes in *PEAK; return the match result as described for
+   patho_case.match, or -2 on error.  */
+
+static long
+patho_run (const patho_case *pc, size_t n, double *ns, size_t *peak)
+{
+  patho_buf pat = { NULL, 0, 0 }, text = { NULL, 0, 0 };
+  regmatch_t pmatch[10];
+  regex_t re;
+  long result;
+  double t0;
+  int err;
+
+  pc->gen (n, &pat, &text);
+  patho_mem_peak = patho_mem_cur;
+
+  t0 = patho_now_ns ();
+  err = regcomp (&re, pat.s, pc->cflags);
+  if (err != 0)
+    {
+      char buf[128];
+      regerror (err, &re, buf, sizeof (buf));
+      fprintf (stderr, "%s: regcomp failed: %s\n", pc->name, buf);
+      free (pat.s);
+      free (text.s);
+      return -2;
+    }
+  if (pc->run == RUN_REGEXEC)
+    result = regexec (&re, text.s, pc->nmatch, pmatch, 0) == 0;
+  else
+    {
+      regoff_t pos = 0, len = (regoff_t) text.len;
+      result = 0;
+      /* REG_STARTEND keeps regexec from measuring the rest of the
+	 subject with strlen at every match.  */
+      for (;;)
+	{
+	  pmatch[0].rm_so = pos;
+	  pmatch[0].rm_eo = len;
+	  if (pos >= len
+	      || regexec (&re, text.s, 1, pmatch, REG_STARTEND) != 0)
+	    break;
+	  ++result;
+	  pos = pmatch[0].rm_eo > pmatch[0].rm_so ? pmatch[0].rm_eo : pos + 1;
+	}
+    }
+  regfree (&re);
+  *ns = patho_now_ns () - t0;
+  *peak = patho_mem_peak - patho_mem_cur;
+
+  free (pat.s);
+  free (text.s);
+  return result;
+}
+
+static int
+patho_cmp_double (const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+  return x < y ? -1 : x > y;
+}
+
+/* Median of PATHO_RUNS measurements of PC at size N.  Each measurement
+   is the mean time of as many runs as fit in PATHO_MIN_MS.  */
+
+static long
+patho_median (const patho_case *pc, size_t n, int verbose, double *ns,
+	      size_t *peak)
+{
+  double times[PATHO_RUNS];
+  long result = -2;
+  int i;
+
+  *peak = 0;
+  for (i = 0; i < PATHO_RUNS; ++i)
+    {
+      double t, sum = 0;
+      unsigned long reps = 0;
+      size_t p;
+
+      do
+	{
+	  result = patho_run (pc, n, &t, &p);
+	  if (result == -2)
+	    return result;
+	  sum += t;
+	  ++reps;
+	  if (p > *peak)
+	    *peak = p;
+	}
+      while (sum < PATHO_MIN_MS * 1e6);
+      times[i] = sum / reps;
+      if (verbose)
+	printf ("  %-16s n=%-8lu %10.3f ms %10lu bytes  x%lu\n", pc->name,
+		(unsigned long) n, times[i] / 1e6, (unsigned long) p, reps);
+    }
+  qsort (times, PATHO_RUNS, sizeof (times[0]), patho_cmp_double);
+  *ns = times[PATHO_RUNS / 2];
+  return result;
+}
+
+/* Switch to a UTF-8 locale.  reg_set_locale only knows zh_CN.utf8; fall
+   back to C.UTF-8, which is enough for the case folding under test.  */
+
+static int
+patho_set_utf8 (int flag)
+{
+  if (!flag)
+    {
+      reg_set_locale (1, 0);
+      setlocale (LC_ALL, "C");
+      return 1;
+    }
+  reg_set_locale (1, 1);
+  if (MB_CUR_MAX == 1 && setlocale (LC_ALL, "C.UTF-8") == NULL)
+    setlocale (LC_ALL, "C.utf8");
+  return MB_CUR_MAX > 1;
+}
+
+int
+main (int argc, char **argv)
+{
+  size_t scale = 1;
+  const char *filter = NULL;
+  int verbose = 0, nfailed = 0;
+  size_t i;
+
+  for (i = 1; i < (size_t) argc; ++i)
+    {
+      if (strcmp (argv[i], "-x") == 0 && i + 1 < (size_t) argc)
+	scale = (size_t) atol (argv[++i]);
+      else if (strcmp (argv[i], "-f") == 0 && i + 1 < (size_t) argc)
+	filter = argv[++i];
+      else if (strcmp (argv[i], "-v") == 0)
+	verbose = 1;
+      else
+	{
+	  fprintf (stderr, "usage: %s [-x SCALE] [-f NAME] [-v]\n", argv[0]);
+	  return 2;
+	}
+    }
+  if (scale == 0)
+    {
+      fputs ("SCALE must be positive\n", stderr);
+      return 2;
+    }
+
+  reg_mem_init (patho_malloc, patho_realloc, patho_free, patho_calloc);
+
+  printf ("%-16s %8s %10s %10s %6s %7s %12s  %s\n", "case", "n",
+	  "t(n) ms", "t(4n) ms", "exp", "max-exp", "peak-bytes", "result");
+
+  for (i = 0; i < NELEM (patho_cases); ++i)
+    {
+      const patho_case *pc = &patho_cases[i];
+      size_t n = pc->n * scale, peak1, peak4;
+      double ns1, ns4, exponent;
+      /* The budgets are recorded for SCALE 1.  */
+      double time_scale = pow ((double) scale, pc->exponent);
+      double mem_scale = pow ((double) scale, pc->mem_exponent);
+      long r1, r4;
+      const char *why = NULL;
+
+      if (filter != NULL && strstr (pc->name, filter) == NULL)
+	continue;
+      if (pc->utf8 && !patho_set_utf8 (1))
+	{
+	  printf ("%-16s skipped: no UTF-8 locale\n", pc->name);
+	  patho_set_utf8 (0);
+	  continue;
+	}
+
+      r1 = patho_median (pc, n, verbose, &ns1, &peak1);
+      r4 = patho_median (pc, 4 * n, verbose, &ns4, &peak4);
+      if (pc->utf8)
+	patho_set_utf8 (0);
+
+      /* Sub-microsecond runs only measure the timer.  */
+      exponent = (ns1 > 1e3 && ns4 > 0) ? log (ns4 / ns1) / log (4.0) : 0;
+
+      if (r1 == -2 || r4 == -2)
+	why = "error";
+      else if (pc->run == RUN_REGEXEC && (r1 != pc->match || r4 != pc->match))
+	why = "wrong result";
+      else if (pc->run == RUN_ALL
+	       && (r1 != pc->match * (long) n || r4 != pc->match * 4 * (long) n))
+	why = "wrong result";
+      else if (exponent > pc->exponent + PATHO_EXPONENT_SLACK)
+	why = "super-linear growth";
+      else if (ns4 / 1e6 > pc->max_ms * time_scale)
+	why = "over time budget";
+      else if (peak4 > pc->max_bytes * mem_scale)
+	why = "over memory budget";
+
+      printf ("%-16s %8lu %10.3f %10.3f %6.2f %7.2f %12lu  %s\n", pc->name,
+	      (unsigned long) n, ns1 / 1e6, ns4 / 1e6, exponent, pc->exponent,
+	      (unsigned long) peak4, why ? why : "ok");
+      fflush (stdout);
+      if (why != NULL)
+	++nfailed;
+    }
+
+  if (patho_mem_cur != 0)
+    {
+      fprintf (stderr, "leaked %lu bytes through reg_mem_init hooks\n",
+	       (unsigned long) patho_mem_cur);
+      ++nfailed;
+    }
+  if (nfailed)
+    fprintf (stderr, "%d case(s) FAILED\n", nfailed);
+  return nfailed != 0;
+}
@@ -95,6 +95,30 @@ typedef void* (*mem_realloc_t)(void*, size_t);
 typedef void  (*mem_free_t)(void*);
 typedef void* (*mem_calloc_t)(int, size_t);
 
+/* What the library allocates memory for, passed to the hooks installed
+   by 'reg_mem_init_tagged'.  */
+typedef enum
+{
+  REG_MEM_COMPILE,	/* Parse tree, NFA nodes, bracket sets and the
+			   other parts of a compiled pattern.  */
+  REG_MEM_NODE_SETS,	/* Node sets of the NFA and of the DFA states.  */
+  REG_MEM_DFA_STATES,	/* DFA states and the state table.  */
+  REG_MEM_TRTABLES,	/* Transition tables and the work space used to
+			   build them.  */
+  REG_MEM_MATCH_CONTEXT,	/* Registers and back reference cache of a
+				   search.  */
+  REG_MEM_STATE_LOG,	/* States logged at each position of a search.  */
+  REG_MEM_FAIL_STACK,	/* Backtracking stack of set_regs.  */
+  REG_MEM_WCS_BUFFERS,	/* Translated, case folded and wide character
+			   copies of the string searched.  */
+  REG_MEM_OTHER,
+  REG_MEM_NCATEGORIES
+} reg_mem_category_t;
+
+typedef void* (*mem_malloc_tagged_t)(size_t, reg_mem_category_t);
+typedef void* (*mem_realloc_tagged_t)(void*, size_t, reg_mem_category_t);
+typedef void* (*mem_calloc_tagged_t)(int, size_t, reg_mem_category_t);
+
 #ifdef __USE_GNU
 /* If this bit is not set, then \ inside a bracket expression is literal.
    If set, then such a \ quotes the following character.  */
@@ -346,6 +370,14 @@ typedef void* (*mem_calloc_t)(int, size_t);
    If not set, then returns differ between not matching and errors.  */
 #define REG_NOSUB (1 << 3)
 
+/* If this bit is set, then regcomp builds every DFA state the pattern
+     can reach and their transition tables, up to RE_DFA_EAGER_MAX_STATES
+     states, and regexec searches that keep no state log run without
+     taking the pattern's lock.
+   If not set, or the pattern has more states, then the DFA is built
+     lazily while matching.  */
+#define REG_DFA_EAGER (1 << 4)
+
 
 /* POSIX 'eflags' bits (i.e., information for regexec).  */
 
@@ -369,7 +401,8 @@ typedef void* (*mem_calloc_t)(int, size_t);
 
 typedef enum
 {
-  _REG_ENOSYS = -1,	/* This will never happen for this implementation.  */
+  _REG_ENOSYS = -1,	/* Not built in (reg_set_trace without
+			   RE_ENABLE_TRACE).  */
   _REG_NOERROR = 0,	/* Success.  */
   _REG_NOMATCH,		/* Didn't find a match (for regexec).  */
 
@@ -553,7 +586,143 @@ typedef struct
   regoff_t rm_so;  /* Byte offset from string's start to substring's start.  */
   regoff_t rm_eo;  /* Byte offset from string's start to substring's end.  */
 } regmatch_t;
+
+/* Counters kept by the matcher for one compiled pattern, see
+   'reg_get_stats'.  All counters except NSTATES accumulate from the time
+   the pattern was compiled or the counters were last reset.  */
+typedef struct
+{
+  size_t nstates;		/* DFA states currently cached.  */
+  size_t nsearches;		/* Calls of the matcher.  */
+  size_t nbuild_trtable;	/* Transition tables built (cache misses).  */
+  size_t fastmap_scanned;	/* Bytes tested against the fastmap.  */
+  size_t fastmap_skipped;	/* Bytes the fastmap rejected as starts.  */
+  size_t dfa_bytes;		/* Bytes consumed by the DFA matcher.  */
+  size_t ncheck_matching;	/* Match attempts at a start position.  */
+  size_t nrestarts;		/* Attempts that failed and moved on.  */
+  size_t nset_regs;		/* Subexpression register extractions.  */
+  size_t nsift_states;		/* Backward sifting passes.  */
+  size_t nflushes;		/* Flushes of the DFA state cache.  */
+  size_t literal_skipped;	/* Bytes skipped as starts because the
+				   literal every match contains was not
+				   found there.  */
+  size_t nreverse;		/* Passes of the reversed pattern that found
+				   the leftmost start after long failed
+				   attempts.  */
+  size_t npure_literal;		/* Searches of a plain literal pattern that
+				   looked for it as a string.  */
+} reg_stats_t;
+
+/* Time in nanoseconds spent in each phase of compiling a pattern, see
+   'reg_get_compile_profile'.  The ANALYZE total includes the phases
+   listed before it.  All times are zero unless profiling is enabled with
+   'reg_set_compile_profile'.  */
+typedef struct
+{
+  unsigned long long init;		/* init_dfa, re_string_construct.  */
+  unsigned long long parse;
+  unsigned long long optimize_subexps;
+  unsigned long long lower_subexps;
+  unsigned long long calc_first;
+  unsigned long long calc_next;
+  unsigned long long link_nfa_nodes;
+  unsigned long long calc_eclosure;
+  unsigned long long calc_inveclosure;
+  unsigned long long analyze;
+  unsigned long long optimize_utf8;
+  unsigned long long create_initial_state;
+  unsigned long long compile_fastmap;	/* Last dm_compile_fastmap call.  */
+  unsigned long long materialize;	/* DFA built for REG_DFA_EAGER.  */
+  unsigned long long total;		/* Whole compilation but the fastmap.  */
+  size_t nnodes;			/* NFA nodes of the pattern.  */
+} reg_compile_profile_t;
+
+/* Callback for 'reg_set_dfa_limit'.  NSTATES and TRTABLE_BYTES are the
+   size the lazy DFA of the pattern would reach, ARG is the argument given
+   to 'reg_set_dfa_limit'.  Return 0 to let the DFA grow past the limits,
+   or nonzero to make the running search fail.  */
+typedef int (*reg_dfa_limit_fn) (size_t __nstates, size_t __trtable_bytes,
+				 void *__arg);
+
+/* Bytes held by a compiled pattern, see 'reg_get_mem_usage'.  The sizes
+   are those requested from the allocator, without its overhead.  */
+typedef struct
+{
+  size_t total;
+  size_t nodes;		/* NFA nodes and the bracket sets they own.  */
+  size_t node_sets;	/* nexts, org_indices, edests, eclosures and
+			   inveclosures.  */
+  size_t state_table;	/* Hash buckets of the DFA state table.  */
+  size_t states;	/* DFA states and their node sets.  */
+  size_t trtables;	/* trtable and word_trtable arrays.  */
+  size_t other;		/* DFA header, fastmap, translate table etc.  */
+  size_t nstates;
+  size_t ntrtables;
+} reg_mem_usage_t;
 
+/* Execution plan chosen for a compiled pattern, see 'reg_explain'.  */
+typedef struct
+{
+  int match_kind;	/* How start positions are found: 8 tries every
+			   position, 6 and 7 skip ahead with the fastmap
+			   (7 through the translate table), 4 and 5 do so
+			   backward, 0 to 3 read the multibyte buffer.  */
+  int anchored;		/* Only the start of the string can match.  */
+  int longest_match;	/* The longest match is searched for.  */
+  int need_state_log;	/* The DFA states are logged at each position.  */
+  int need_prune;	/* prune_impossible_nodes runs after a match.  */
+  int need_set_regs;	/* set_regs fills the subexpression registers.  */
+  int multibyte;	/* The text is read as multibyte characters.  */
+  size_t nbackref;	/* Back references, resolved through the back
+			   reference cache (get_subexp, check_arrival).  */
+  size_t nmatch;	/* Registers filled after clipping NMATCH.  */
+  size_t nnodes;	/* NFA nodes.  */
+  size_t nstates;	/* DFA states built so far.  */
+  size_t nbyte_classes;	/* Entries of a transition table: the classes
+			   of bytes the DFA cannot tell apart.  */
+  int materialized;	/* regcomp built the whole DFA (REG_DFA_EAGER).  */
+  int lock_free;	/* The search takes the pattern's lock only
+			   briefly, to build DFA states and to add up
+			   its counters.  */
+  size_t required_len;	/* Length of a literal every match contains,
+			   searched for before the DFA runs, or 0.  */
+  int required_at_start; /* Every match starts with that literal, so
+			   the search jumps from one to the next.  */
+  int fastmap_width;	/* Bytes the forward fastmap scan tests at a
+			   time: a word, or 16 or 32 with vector
+			   instructions, when few bytes or vector
+			   instructions allow it, else 1.  */
+  int fastmap_memchr;	/* The forward fastmap scan is memchr for the
+			   only byte that may start a match.  */
+  int reverse_start;	/* Once failed attempts read too much, the
+			   leftmost start is found by one backward pass
+			   of the reversed pattern.  */
+  size_t pure_literal_len; /* Length of the pattern if it is a plain
+			   literal, looked for as a string without the
+			   DFA, or 0.  */
+} reg_explain_t;
+
+/* Trace points of the matcher, see 'reg_set_trace'.  A and B are the
+   two values passed along with each point.  */
+typedef enum
+{
+  REG_TRACE_EXEC_ENTRY,		/* A search starts: A is the length of the
+				   string, B the first start position.  */
+  REG_TRACE_EXEC_EXIT,		/* A search ends: A is the error code, B
+				   the start of the match or -1.  */
+  REG_TRACE_RECONSTRUCT,	/* re_string_reconstruct: A is the new
+				   start index, B the old one.  */
+  REG_TRACE_BUILD_TRTABLE,	/* A transition table is missing: A is
+				   the nodes of the state, B the index.  */
+  REG_TRACE_EXTEND_BUFFERS,	/* extend_buffers: A is the old buffer
+				   length, B the minimum requested.  */
+  REG_TRACE_SET_REGS		/* One step of set_regs: A is the node, B
+				   the index in the string.  */
+} reg_trace_point_t;
+
+typedef void (*reg_trace_fn) (reg_trace_point_t __point, size_t __a,
+			      size_t __b, void *__arg);
+
 /* Declarations for routines.  */
 
 #ifdef __USE_GNU
@@ -694,6 +863,85 @@ DllExport void reg_mem_init(
     mem_calloc_t  mem_calloc_fun
 );
 
+/* Like 'reg_mem_init', but the allocation hooks also receive the category
+   of each request.  Blocks are still released through MEM_FREE_FUN, so a
+   hook that reports usage by category must remember the category of each
+   block itself.  A later call to 'reg_mem_init' removes these hooks.  */
+DllExport void reg_mem_init_tagged (mem_malloc_tagged_t __mem_malloc_fun,
+				    mem_realloc_tagged_t __mem_realloc_fun,
+				    mem_free_t __mem_free_fun,
+				    mem_calloc_tagged_t __mem_calloc_fun);
+
+/* Copy the matcher counters of the pattern compiled in PREG to STATS.
+   Return REG_NOERROR, or REG_BADPAT if PREG holds no compiled pattern.  */
+DllExport int reg_get_stats (const regex_t *__preg, reg_stats_t *__stats);
+
+/* Clear the accumulated matcher counters of PREG.  */
+DllExport void reg_reset_stats (regex_t *__preg);
+
+/* Enable (FLAG nonzero) or disable timing of the compilation phases for
+   the whole process.  It is off by default, since reading the clock costs
+   a noticeable part of compiling a short pattern.  */
+DllExport void reg_set_compile_profile (int __flag);
+
+/* Copy the compile-phase timing of PREG to PROFILE.  Return REG_NOERROR,
+   or REG_BADPAT if PREG holds no compiled pattern.  */
+DllExport int reg_get_compile_profile (const regex_t *__preg,
+				       reg_compile_profile_t *__profile);
+
+/* Store in USAGE the bytes the compiled pattern PREG currently holds.
+   The lazy DFA grows while the pattern is used, so the result changes
+   between calls.  Return REG_NOERROR, or REG_BADPAT if PREG holds no
+   compiled pattern.  */
+DllExport int reg_get_mem_usage (const regex_t *__preg,
+				 reg_mem_usage_t *__usage);
+
+/* Limit the lazy DFA of PREG to MAX_STATES states and MAX_TRTABLE_BYTES
+   bytes of transition tables; zero means no limit.  When a search would
+   pass a limit, FN is called with ARG.  If FN is NULL or returns nonzero
+   the search fails: regexec returns nonzero and re_search returns -2, and
+   FN is asked again the next time the DFA would grow.  Once FN returns 0
+   the limits are ignored until they are set again.  Return REG_NOERROR,
+   or REG_BADPAT if PREG holds no compiled pattern.  */
+DllExport int reg_set_dfa_limit (regex_t *__preg, size_t __max_states,
+				 size_t __max_trtable_bytes,
+				 reg_dfa_limit_fn __fn, void *__arg);
+
+/* Keep the states and transition tables the lazy DFA of PREG caches
+   within about MAX_BYTES bytes; zero means no budget.  When the cache
+   outgrows the budget it is flushed and built again on demand, and the
+   running search goes on.  Searches that keep a state log (those asking
+   for subexpressions, or matching back references or multibyte
+   characters) flush only when they end.  Return REG_NOERROR, or
+   REG_BADPAT if PREG holds no compiled pattern.  */
+DllExport int reg_set_dfa_cache_budget (regex_t *__preg, size_t __max_bytes);
+
+/* Make SHARD match like PREG, sharing its compiled NFA and the DFA
+   'regcomp' built for REG_DFA_EAGER, but with a lazy DFA cache of its
+   own, so that a thread matching SHARD never waits for those matching
+   PREG or its other shards.  SHARD starts with the DFA limits and cache
+   budget of PREG, which may then be set for it alone.  Free SHARD with
+   'regfree' before PREG.  Return REG_NOERROR, REG_BADPAT if PREG holds
+   no compiled pattern, or REG_ESPACE.  */
+DllExport int reg_dfa_shard (const regex_t *__preg, regex_t *__shard);
+
+/* Describe in *EXPLAIN how 'regexec' would match PREG when asked for
+   NMATCH registers, without matching anything.  */
+DllExport int reg_explain (const regex_t *__preg, size_t __nmatch,
+			   reg_explain_t *__explain);
+
+/* Write a readable form of *EXPLAIN into BUF, truncated to SIZE bytes
+   like 'regerror'.  Return the size needed, including the null.  */
+DllExport size_t reg_explain_format (const reg_explain_t *__explain,
+				     char *__buf, size_t __size);
+
+/* Call FN with ARG at every trace point of the matcher; a null FN stops
+   tracing.  Like 'reg_mem_init', call it before other threads use the
+   library.  The trace points only exist when the library is built with
+   RE_ENABLE_TRACE, otherwise REG_ENOSYS is returned.  With HAVE_SYS_SDT_H
+   they are also USDT probes of provider "dmregex".  */
+DllExport int reg_set_trace (reg_trace_fn __fn, void *__arg);
+
 #ifdef __cplusplus
 }
 #endif	/* C++ */
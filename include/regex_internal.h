@@ -91,6 +91,42 @@
 # define lock_unlock(lock) ((void) 0)
 #endif
 
+/* Accesses to the DFA shared with the searches that run without its lock,
+   see search_is_shared.  A transition table is filled before it is
+   stored with release semantics, so that a search loading it with
+   acquire semantics sees it whole.  Without these builtins every search
+   takes the lock.  */
+#if ((defined __GNUC__ && 4 < __GNUC__ + (7 <= __GNUC_MINOR__)) \
+     || defined __clang__)
+# define RE_HAVE_ATOMICS 1
+# define re_atomic_load_acquire(p) __atomic_load_n (p, __ATOMIC_ACQUIRE)
+# define re_atomic_store_release(p, v) \
+  __atomic_store_n (p, v, __ATOMIC_RELEASE)
+# define re_atomic_get(p) __atomic_load_n (p, __ATOMIC_SEQ_CST)
+# define re_atomic_set(p, v) __atomic_store_n (p, v, __ATOMIC_SEQ_CST)
+# define re_atomic_add(p, v) ((void) __atomic_fetch_add (p, v, \
+							 __ATOMIC_SEQ_CST))
+#else
+# define re_atomic_load_acquire(p) (*(p))
+# define re_atomic_store_release(p, v) ((void) (*(p) = (v)))
+# define re_atomic_get(p) (*(p))
+# define re_atomic_set(p, v) ((void) (*(p) = (v)))
+# define re_atomic_add(p, v) ((void) (*(p) += (v)))
+#endif
+
+/* The forward fastmap scan tests 16 or 32 bytes at a time with SSE2,
+   SSSE3 or AVX2 instructions, chosen by calc_fastmap_scan from what
+   the processor running it supports.  The kernels for the latter two
+   are compiled for them whatever the flags, with the target attribute
+   spelled so that the definition of __attribute__ below leaves it.  */
+#if ((defined __x86_64__ || defined __i386__) && defined __SSE2__ \
+     && ((defined __GNUC__ && 4 < __GNUC__ + (9 <= __GNUC_MINOR__)) \
+	 || defined __clang__))
+# define RE_HAVE_SIMD_SCAN 1
+# define re_target(isa) __attribute ((target (isa)))
+# include <immintrin.h>
+#endif
+
 /* In case that the system doesn't have isblank().  */
 #if !defined _LIBC && ! (defined isblank || (HAVE_ISBLANK && HAVE_DECL_ISBLANK))
 # define isblank(ch) ((ch) == ' ' || (ch) == '\t')
@@ -135,6 +171,12 @@
 
 #define COLL_ELEM_LEN_MAX 8
 
+/* Most DFA states regcomp builds for REG_DFA_EAGER; a pattern with more
+   falls back to the lazy DFA.  */
+#ifndef RE_DFA_EAGER_MAX_STATES
+# define RE_DFA_EAGER_MAX_STATES 1024
+#endif
+
 /* The character which represents newline.  */
 #define NEWLINE_CHAR '\n'
 #define WIDE_NEWLINE_CHAR L'\n'
@@ -195,6 +237,11 @@ typedef regoff_t Idx;
 /* A hash value, suitable for computing hash tables.  */
 typedef __re_size_t re_hashval_t;
 
+/* The number of a state in re_dfa_t.eager_block, 0 standing for no state.
+   The transition tables of those states hold numbers rather than
+   pointers, which on 64-bit hosts halves them.  */
+typedef uint32_t re_state_id_t;
+
 //#ifndef __GNUC__
 # define __attribute__(arg)
 
@@ -296,13 +343,45 @@ typedef enum
   NOT_WORD_DELIM = NOT_WORD_DELIM_CONSTRAINT
 } re_context_type;
 
+/* Number of elements a re_node_set holds without a heap allocation.
+   Most sets (the eclosure of a plain character, the edests of a
+   branch, the inveclosure of a state with a single node) have one or
+   two elements, and the space of the elems pointer fits them.  */
+#define RE_NODE_SET_INLINE 2
+
 typedef struct
 {
   Idx alloc;
   Idx nelem;
-  Idx *elems;
+  /* The elements are in INLINE_ELEMS while ALLOC is at most
+     RE_NODE_SET_INLINE, and in the heap buffer ELEMS otherwise;
+     use re_node_set_elems to get at them.  */
+  union
+  {
+    Idx *elems;
+    Idx inline_elems[RE_NODE_SET_INLINE];
+  } u;
 } re_node_set;
 
+#define re_node_set_elems(set) \
+  ((set)->alloc <= RE_NODE_SET_INLINE ? (set)->u.inline_elems : (set)->u.elems)
+
+/* Largest number of nodes for which unions of many node sets are
+   accumulated in a re_node_bitset, one bit per node index, instead of
+   merging sorted arrays one set at a time.  */
+#define RE_NODE_BITSET_MAX 16384
+#define RE_NODE_BITSET_WORDS \
+  ((RE_NODE_BITSET_MAX + BITSET_WORD_BITS - 1) / BITSET_WORD_BITS)
+
+typedef struct
+{
+  /* Only the words from LO to HI may have bits set.  */
+  Idx lo, hi;
+  /* Sum of the sizes of the sets added, a bound on the union's size.  */
+  Idx nadded;
+  bitset_word_t words[RE_NODE_BITSET_WORDS];
+} re_node_bitset;
+
 typedef enum
 {
   NON_TYPE = 0,
@@ -502,12 +581,48 @@ struct reg_mem_t
     mem_realloc_t   mem_realloc;
     mem_free_t      mem_free;
     mem_calloc_t    mem_calloc;
+    /* Set by reg_mem_init_tagged; used instead of the hooks above.  */
+    mem_malloc_tagged_t  mem_malloc_tagged;
+    mem_realloc_tagged_t mem_realloc_tagged;
+    mem_calloc_tagged_t  mem_calloc_tagged;
 };
 typedef struct reg_mem_t reg_mem_t;
 
 //674671 úȡ&g_reg_memӰܸΪextern g_reg_mem
 extern reg_mem_t g_reg_mem;
 
+/* Trace points, see reg_set_trace.  re_trace compiles to nothing unless
+   RE_ENABLE_TRACE is defined.  A and B must not have side effects.  */
+#ifdef RE_ENABLE_TRACE
+struct reg_trace_t
+{
+  reg_trace_fn fn;
+  void *arg;
+};
+typedef struct reg_trace_t reg_trace_t;
+
+extern reg_trace_t g_reg_trace;
+
+# ifdef HAVE_SYS_SDT_H
+#  include <sys/sdt.h>
+#  define re_trace_probe(point, a, b) DTRACE_PROBE2 (dmregex, point, a, b)
+# else
+#  define re_trace_probe(point, a, b) ((void) 0)
+# endif
+
+# define re_trace(point, a, b)						      \
+  do									      \
+    {									      \
+      re_trace_probe (point, a, b);					      \
+      if (__glibc_unlikely (g_reg_trace.fn != NULL))			      \
+	g_reg_trace.fn (REG_TRACE_##point, (size_t) (a), (size_t) (b),	      \
+			g_reg_trace.arg);				      \
+    }									      \
+  while (0)
+#else
+# define re_trace(point, a, b) ((void) 0)
+#endif
+
 #ifndef _LIBC
 # define IS_IN(libc) false
 #endif
@@ -583,10 +698,16 @@ unsigned int re_string_context_at (const re_string_t *input, Idx idx,
 #endif
 
 // SMR-־Զ-20241227-004 ⲿṩڴ溯ʹⲿģʹϵͳ
-#define re_malloc(t,n) (g_reg_mem.mem_malloc == NULL ? (t *) malloc ((n) * sizeof (t)) : (t *) g_reg_mem.mem_malloc((n) * sizeof (t)))
-#define re_realloc(p,t,n) (g_reg_mem.mem_realloc == NULL ? (t *) realloc (p, (n) * sizeof (t)) : (t *) g_reg_mem.mem_realloc(p, (n) * sizeof (t)))
+#define re_malloc(t,n) re_malloc_tag (t, n, REG_MEM_OTHER)
+#define re_realloc(p,t,n) re_realloc_tag (p, t, n, REG_MEM_OTHER)
 #define re_free(p) {if (NULL != p) g_reg_mem.mem_free == NULL ? free (p) : g_reg_mem.mem_free(p);}
-#define re_calloc(t, n) (g_reg_mem.mem_calloc == NULL ? calloc (t, n) : g_reg_mem.mem_calloc (t, n))
+#define re_calloc(t, n) re_calloc_tag (t, n, REG_MEM_OTHER)
+
+/* The same, with the reg_mem_category_t C of the request for the hooks of
+   reg_mem_init_tagged.  */
+#define re_malloc_tag(t,n,c) (g_reg_mem.mem_malloc_tagged != NULL ? (t *) g_reg_mem.mem_malloc_tagged ((n) * sizeof (t), c) : g_reg_mem.mem_malloc == NULL ? (t *) malloc ((n) * sizeof (t)) : (t *) g_reg_mem.mem_malloc((n) * sizeof (t)))
+#define re_realloc_tag(p,t,n,c) (g_reg_mem.mem_realloc_tagged != NULL ? (t *) g_reg_mem.mem_realloc_tagged (p, (n) * sizeof (t), c) : g_reg_mem.mem_realloc == NULL ? (t *) realloc (p, (n) * sizeof (t)) : (t *) g_reg_mem.mem_realloc(p, (n) * sizeof (t)))
+#define re_calloc_tag(t,n,c) (g_reg_mem.mem_calloc_tagged != NULL ? g_reg_mem.mem_calloc_tagged (t, n, c) : g_reg_mem.mem_calloc == NULL ? calloc (t, n) : g_reg_mem.mem_calloc (t, n))
 
 /* дdmڴй©ʹ */
 // #define re_malloc(t,n) ((t *) dm_malloc ((n) * sizeof (t)))
@@ -709,6 +830,9 @@ struct re_dfastate_t
   re_node_set inveclosure;
   re_node_set *entrance_nodes;
   struct re_dfastate_t **trtable, **word_trtable;
+  /* The transition table of a state moved to DFA->eager_block, which
+     replaces the two above, see re_dfa_pack_eager.  */
+  re_state_id_t *eager_trtable;
   unsigned int context : 4;
   unsigned int halt : 1;
   /* If this state can accept "multi byte".
@@ -718,14 +842,22 @@ struct re_dfastate_t
   /* If this state has backreference node(s).  */
   unsigned int has_backref : 1;
   unsigned int has_constraint : 1;
+  /* If this state was built by re_dfa_materialize.  Its transition table
+     leads only to such states, and neither is ever flushed.  */
+  unsigned int materialized : 1;
+  /* If EAGER_TRTABLE has two entries per byte class, like WORD_TRTABLE.  */
+  unsigned int eager_word : 1;
 };
 typedef struct re_dfastate_t re_dfastate_t;
 
+/* Slot of the open addressing state table; STATE is NULL when the slot
+   is free.  The hash is kept in the slot so that probing need not load
+   the states.  */
+
 struct re_state_table_entry
 {
-  Idx num;
-  Idx alloc;
-  re_dfastate_t **array;
+  re_hashval_t hash;
+  re_dfastate_t *state;
 };
 
 /* Array type used in re_sub_match_last_t and re_sub_match_top_t.  */
@@ -796,6 +928,10 @@ typedef struct
   Idx nsub_tops;
   Idx asub_tops;
   re_sub_match_top_t **sub_tops;
+  /* Counters of this search, added to the DFA's when it finishes.  */
+  reg_stats_t stats;
+  /* The search runs without DFA->lock, see search_is_shared.  */
+  bool shared;
 } re_match_context_t;
 
 typedef struct
@@ -822,6 +958,64 @@ struct re_fail_stack_t
   struct re_fail_stack_ent_t *stack;
 };
 
+/* Longest literal calc_required_literal keeps.  */
+#define RE_REQ_LIT_MAX 32
+
+
+/* A forward search finds the leftmost start with the reversed pattern
+   once its failed attempts have read this many bytes more than twice
+   the rest of the string, see find_leftmost_start.  */
+#define RE_REVERSE_SLACK 1024
+
+typedef enum
+{
+  RE_SCAN_BYTE,		/* One byte at a time.  */
+  RE_SCAN_MEMCHR,	/* memchr for the only byte, VALUE[0].  */
+  RE_SCAN_WORD,		/* Compare a word of bytes with each VALUE.  */
+  RE_SCAN_SSE2,		/* Compare 16 bytes with each VALUE.  */
+  RE_SCAN_SSSE3,	/* Look 16 bytes up in LO and HI.  */
+  RE_SCAN_AVX2		/* Look 32 bytes up in LO and HI.  */
+} re_scan_kind_t;
+
+/* The bytes the fastmap lets a forward search start at, composed with
+   the translate table, see calc_fastmap_scan and scan_fastmap.  */
+typedef struct
+{
+  re_scan_kind_t kind;
+  /* The translate table MAP was computed through.  */
+  RE_TRANSLATE_TYPE translate;
+  /* Byte C may start a match iff MAP[C].  */
+  char map[SBC_MAX];
+  /* The number of bytes MAP admits.  Unless NVALUES is 0, these are
+     the bytes C with (C | OR_MASK[I]) == VALUE[I] for an I below
+     NVALUES: two bytes differing in one bit, such as the two cases of
+     a letter, take one entry.  */
+  int nbytes;
+  int nvalues;
+  unsigned char or_mask[3];
+  unsigned char value[3];
+  /* MAP[C] implies LO[C & 15] & HI[C >> 4] != 0: each bit stands for a
+     group of high nibbles admitting the same low nibbles.  If more
+     than eight groups are needed, the last bit stands for the union of
+     the rest, and the tables admit some bytes MAP does not.  */
+  unsigned char lo[16];
+  unsigned char hi[16];
+} re_fastmap_scan_t;
+
+/* A pattern that matches only the string BYTES, LEN bytes long, as the
+   pattern reads it: FOLD maps a byte of the text through the translate
+   table and RE_ICASE the same way.  BORDER[Q] is the longest proper
+   border of the first Q bytes, and FIRST admits the bytes that fold to
+   BYTES[0]; see calc_pure_literal and find_pure_literal.  */
+typedef struct
+{
+  Idx len;
+  unsigned char *bytes;
+  Idx *border;
+  unsigned char fold[SBC_MAX];
+  re_fastmap_scan_t first;
+} re_pure_literal_t;
+
 struct re_dfa_t
 {
   re_token_t *nodes;
@@ -832,6 +1026,8 @@ struct re_dfa_t
   re_node_set *edests;
   re_node_set *eclosures;
   re_node_set *inveclosures;
+  /* STATE_HASH_MASK + 1 slots, a power of 2; at most half of them hold
+     one of the NSTATES states.  */
   struct re_state_table_entry *state_table;
   re_dfastate_t *init_state;
   re_dfastate_t *init_state_word;
@@ -861,11 +1057,71 @@ struct re_dfa_t
   unsigned int word_ops_used : 1;
   int mb_cur_max;
   bitset_t word_char;
+  /* Transition tables have an entry per class of bytes the DFA cannot
+     tell apart, see calc_byte_classes, instead of one per byte.  */
+  unsigned char byte_class[SBC_MAX];
+  int nbyte_classes;
+  /* A literal every match contains, REQ_LEN bytes long or 0 if none is
+     known, and whether every match starts with it; see
+     calc_required_literal.  */
+  unsigned char req_lit[RE_REQ_LIT_MAX];
+  Idx req_len;
+  unsigned int req_at_start : 1;
+  /* The string the pattern matches if it is a plain literal, or NULL.  */
+  re_pure_literal_t *pure_lit;
+  /* Set with the fastmap by dm_compile_fastmap.  */
+  re_fastmap_scan_t fastmap_scan;
   reg_syntax_t syntax;
   Idx *subexp_map;
 #ifdef DEBUG
   char* re_str;
 #endif
+  /* Matcher counters, protected by LOCK.  */
+  reg_stats_t stats;
+  reg_compile_profile_t profile;
+  /* Size of the lazy DFA, and the limits set by reg_set_dfa_limit.  */
+  size_t nstates;
+  size_t trtable_bytes;
+  size_t max_states;
+  size_t max_trtable_bytes;
+  /* Bytes of the cached states, and the budget set by
+     reg_set_dfa_cache_budget for them and the transition tables.  */
+  size_t state_bytes;
+  size_t cache_budget;
+  reg_dfa_limit_fn limit_fn;
+  void *limit_arg;
+  unsigned int limit_waived : 1;
+  /* If every state reachable from the initial states has its transition
+     table, built at regcomp for REG_DFA_EAGER.  EAGER_STATES lists those
+     states and EAGER_BYTES is their share of the sizes above.  */
+  unsigned int materialized : 1;
+  re_dfastate_t **eager_states;
+  Idx neager_states;
+  size_t eager_bytes;
+  /* Those states by number, EAGER_BLOCK[0] being unused, and their
+     transition tables, unless re_dfa_pack_eager ran out of memory.  */
+  re_dfastate_t *eager_block;
+  re_state_id_t *eager_trtables;
+  /* The DFA this one is a shard of, see reg_dfa_shard, or NULL.  It owns
+     the NFA and the states built for REG_DFA_EAGER.  */
+  const re_dfa_t *master;
+  /* A copy of the pattern, and the pattern compiled from it by
+     re_compile_reverse on the first search that needs it, or NULL.
+     REV_PATTERN is NULL if the pattern has back references or
+     multibyte characters, and REVERSE_FAILED set if compiling it
+     failed.  They belong to the master and are guarded by its LOCK.
+     REVERSED is set in REVERSE itself, whose pattern is parsed to match
+     the reversed text.  */
+  char *rev_pattern;
+  size_t rev_pattern_len;
+  regex_t *reverse;
+  unsigned int reverse_failed : 1;
+  unsigned int reversed : 1;
+  /* The searches running without LOCK, and whether a flush of the cache
+     waits for them to finish, see flush_over_budget.  Both are accessed
+     with re_atomic_get and friends.  */
+  Idx nshared;
+  bool flush_pending;
   lock_define (lock)
 };
 
@@ -873,7 +1129,11 @@ struct re_dfa_t
 #define re_node_set_remove(set,id) \
   (re_node_set_remove_at (set, re_node_set_contains (set, id) - 1))
 #define re_node_set_empty(p) ((p)->nelem = 0)
-#define re_node_set_free(set) re_free ((set)->elems)
+#define re_node_set_free(set) \
+  {if ((set)->alloc > RE_NODE_SET_INLINE) re_free ((set)->u.elems);}
+/* Bytes of heap SET uses for its elements.  */
+#define re_node_set_heap_size(set) \
+  ((set)->alloc > RE_NODE_SET_INLINE ? (set)->alloc * sizeof (Idx) : 0)
 
 
 typedef enum
@@ -1000,6 +1260,10 @@ Idx
 __attribute__ ((pure))
 re_node_set_contains (const re_node_set *set, Idx elem);
 
+bool
+__attribute__ ((pure))
+re_node_set_compare (const re_node_set *set1, const re_node_set *set2);
+
 reg_errcode_t
 __attribute_warn_unused_result__
 re_node_set_init_copy (re_node_set *dest, const re_node_set *src);
@@ -1030,9 +1294,52 @@ re_node_set_add_intersect (re_node_set *dest, const re_node_set *src1,
 void
 re_node_set_remove_at (re_node_set *set, Idx idx);
 
+void
+re_node_bitset_init (re_node_bitset *bits, Idx nodes_len);
+
+void
+re_node_bitset_add (re_node_bitset *bits, const re_node_set *set);
+
+reg_errcode_t
+__attribute_warn_unused_result__
+re_node_bitset_take (re_node_bitset *bits, re_node_set *dest);
+
 void
 free_state (re_dfastate_t *state);
 
+reg_errcode_t
+__attribute_warn_unused_result__
+re_dfa_check_limit (const re_dfa_t *dfa, Idx nstates, size_t trtable_bytes);
+
+void
+re_dfa_add_size (const re_dfa_t *dfa, Idx nstates, size_t trtable_bytes);
+
+void
+re_dfa_flush_states (const re_dfa_t *dfa, re_dfastate_t *keep);
+
+size_t
+calc_state_size (const re_dfastate_t *state);
+
+size_t
+calc_trtable_size (const re_dfa_t *dfa, const re_dfastate_t *state);
+
+bool
+re_dfa_materialize (re_dfa_t *dfa, Idx max_states);
+
+void
+re_dfa_minimize (re_dfa_t *dfa);
+
+bool
+re_dfa_pack_eager (re_dfa_t *dfa);
+
+reg_errcode_t
+__attribute_warn_unused_result__
+re_dfa_init_shard (re_dfa_t *shard);
+
+reg_errcode_t
+__attribute_warn_unused_result__
+re_compile_reverse (const regex_t *preg, regex_t **reverse);
+
 reg_errcode_t
 __attribute_warn_unused_result__
 re_string_construct (re_string_t *pstr, const char *str, Idx len,
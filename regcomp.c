@@ -21,22 +21,38 @@
    <https://www.gnu.org/licenses/>.  */
 
 #include "regex_internal.h"
+#include <time.h>
 
 #ifdef _LIBC
 # include <locale/weight.h>
 #endif
 
 static reg_errcode_t re_compile_internal (regex_t *preg, const char * pattern,
-					  size_t length, reg_syntax_t syntax);
+					  size_t length, reg_syntax_t syntax,
+					  bool reversed);
 static void re_compile_fastmap_iter (regex_t *bufp,
 				     const re_dfastate_t *init_state,
 				     char *fastmap);
+static void calc_fastmap_scan (re_fastmap_scan_t *scan, const char *fastmap,
+			       RE_TRANSLATE_TYPE t);
 static reg_errcode_t init_dfa (re_dfa_t *dfa, size_t pat_len);
+static unsigned long long re_profile_clock (void);
+static void re_profile_add (unsigned long long *phase,
+			    unsigned long long *stamp);
 #ifdef RE_ENABLE_I18N
 static void free_charset (re_charset_t *cset);
 #endif /* RE_ENABLE_I18N */
 static void free_workarea_compile (regex_t *preg);
 static reg_errcode_t create_initial_state (re_dfa_t *dfa);
+static reg_errcode_t acquire_initial_states (re_dfa_t *dfa,
+					     const re_node_set *init_nodes);
+static void calc_byte_classes (re_dfa_t *dfa);
+static int split_byte_classes (bitset_t *classes, int nclasses,
+			       const bitset_t set);
+static void calc_required_literal (re_dfa_t *dfa, const regex_t *preg);
+static void calc_pure_literal (re_dfa_t *dfa, const regex_t *preg);
+static void keep_reverse_pattern (re_dfa_t *dfa, const regex_t *preg,
+				  const char *pattern, size_t length);
 #ifdef RE_ENABLE_I18N
 static void optimize_utf8 (re_dfa_t *dfa);
 #endif
@@ -67,6 +83,8 @@ static int peek_token (re_token_t *token, re_string_t *input,
 			reg_syntax_t syntax);
 static bin_tree_t *parse (re_string_t *regexp, regex_t *preg,
 			  reg_syntax_t syntax, reg_errcode_t *err);
+static bin_tree_t *parse_reverse_prefix (re_dfa_t *dfa, bin_tree_t *tree,
+					 reg_errcode_t *err);
 static bin_tree_t *parse_reg_exp (re_string_t *regexp, regex_t *preg,
 				  re_token_t *token, reg_syntax_t syntax,
 				  Idx nest, reg_errcode_t *err);
@@ -239,7 +257,7 @@ re_compile_pattern (const char *pattern, size_t length,
   /* Match anchors at newline.  */
   bufp->newline_anchor = 1;
 
-  ret = re_compile_internal (bufp, pattern, length, re_syntax_options);
+  ret = re_compile_internal (bufp, pattern, length, re_syntax_options, false);
 
   if (!ret)
     return NULL;
@@ -273,6 +291,7 @@ dm_compile_fastmap (struct re_pattern_buffer *bufp)
 {
   re_dfa_t *dfa = bufp->buffer;
   char *fastmap = bufp->fastmap;
+  unsigned long long stamp = re_profile_clock ();
 
   memset (fastmap, '\0', sizeof (char) * SBC_MAX);
   re_compile_fastmap_iter (bufp, dfa->init_state, fastmap);
@@ -282,13 +301,109 @@ dm_compile_fastmap (struct re_pattern_buffer *bufp)
     re_compile_fastmap_iter (bufp, dfa->init_state_nl, fastmap);
   if (dfa->init_state != dfa->init_state_begbuf)
     re_compile_fastmap_iter (bufp, dfa->init_state_begbuf, fastmap);
+  calc_fastmap_scan (&dfa->fastmap_scan, fastmap, bufp->translate);
   bufp->fastmap_accurate = 1;
+  dfa->profile.compile_fastmap = 0;
+  re_profile_add (&dfa->profile.compile_fastmap, &stamp);
   return 0;
 }
 #ifdef _LIBC
 weak_alias (__re_compile_fastmap, dm_compile_fastmap)
 #endif
 
+/* Set SCAN for FASTMAP seen through the translate table T: the map of
+   the bytes a forward search may start at, the values to compare bytes
+   with if they are few, the nibble tables of the vector scan, and the
+   fastest scan the processor supports.  */
+
+static void
+calc_fastmap_scan (re_fastmap_scan_t *scan, const char *fastmap,
+		   RE_TRANSLATE_TYPE t)
+{
+  unsigned int lows[16], groups[8];
+  char paired[SBC_MAX];
+  int c, h, k, bit, ngroups = 0;
+
+  scan->translate = t;
+  scan->nbytes = 0;
+  memset (lows, '\0', sizeof lows);
+  for (c = 0; c < SBC_MAX; ++c)
+    {
+      scan->map[c] = fastmap[t ? t[c] : c] != 0;
+      if (scan->map[c])
+	{
+	  ++scan->nbytes;
+	  lows[c >> 4] |= 1u << (c & 15);
+	}
+    }
+
+  /* Pair each byte with a later one differing from it in one bit, if
+     any, so that a case-insensitive letter takes one value.  */
+  scan->nvalues = 0;
+  memset (paired, '\0', sizeof paired);
+  for (c = 0; c < SBC_MAX && scan->nbytes <= 6; ++c)
+    if (scan->map[c] && !paired[c])
+      {
+	if (scan->nvalues == 3)
+	  {
+	    scan->nvalues = 0;
+	    break;
+	  }
+	for (bit = 1; bit < SBC_MAX; bit <<= 1)
+	  if (!(c & bit) && scan->map[c | bit] && !paired[c | bit])
+	    break;
+	if (bit == SBC_MAX)
+	  bit = 0;
+	paired[c | bit] = 1;
+	scan->or_mask[scan->nvalues] = bit;
+	scan->value[scan->nvalues++] = c | bit;
+      }
+
+  /* Group the high nibbles by the low nibbles they admit.  */
+  memset (scan->lo, '\0', sizeof scan->lo);
+  memset (scan->hi, '\0', sizeof scan->hi);
+  for (h = 0; h < 16; ++h)
+    {
+      if (lows[h] == 0)
+	continue;
+      for (k = 0; k < ngroups && groups[k] != lows[h]; ++k)
+	;
+      if (k == ngroups)
+	{
+	  if (ngroups < 8)
+	    groups[ngroups++] = lows[h];
+	  else
+	    groups[--k] |= lows[h];
+	}
+      scan->hi[h] = 1 << k;
+    }
+  for (k = 0; k < ngroups; ++k)
+    for (c = 0; c < 16; ++c)
+      if (groups[k] & (1u << c))
+	scan->lo[c] |= 1 << k;
+
+  /* Nothing is skipped if every byte may start a match.  The C
+     library's memchr is the fastest scan for a single byte; compares
+     beat the SSSE3 lookups, but not the AVX2 ones.  */
+  scan->kind = RE_SCAN_BYTE;
+  if (scan->nbytes == 1)
+    scan->kind = RE_SCAN_MEMCHR;
+  else if (scan->nbytes < SBC_MAX)
+    {
+#ifdef RE_HAVE_SIMD_SCAN
+      if (__builtin_cpu_supports ("avx2"))
+	scan->kind = RE_SCAN_AVX2;
+      else if (scan->nvalues != 0)
+	scan->kind = RE_SCAN_SSE2;
+      else if (__builtin_cpu_supports ("ssse3"))
+	scan->kind = RE_SCAN_SSSE3;
+#else
+      if (scan->nvalues != 0)
+	scan->kind = RE_SCAN_WORD;
+#endif
+    }
+}
+
 static inline void
 __attribute__ ((always_inline))
 re_set_fastmap (char *fastmap, bool icase, int ch)
@@ -310,7 +425,7 @@ re_compile_fastmap_iter (regex_t *bufp, const re_dfastate_t *init_state,
   bool icase = (dfa->mb_cur_max == 1 && (bufp->syntax & RE_ICASE));
   for (node_cnt = 0; node_cnt < init_state->nodes.nelem; ++node_cnt)
     {
-      Idx node = init_state->nodes.elems[node_cnt];
+      Idx node = re_node_set_elems (&init_state->nodes)[node_cnt];
       re_token_type_t type = dfa->nodes[node].type;
 
       if (type == CHARACTER)
@@ -525,7 +640,7 @@ regcomp (regex_t *_Restrict_ preg, const char *_Restrict_ pattern, int cflags)
   preg->no_sub = !!(cflags & REG_NOSUB);
   preg->translate = NULL;
 
-  ret = re_compile_internal (preg, pattern, strlen (pattern), syntax);
+  ret = re_compile_internal (preg, pattern, strlen (pattern), syntax, false);
 
   /* POSIX doesn't distinguish between an unmatched open-group and an
      unmatched close-group: both are REG_EPAREN.  */
@@ -534,9 +649,29 @@ regcomp (regex_t *_Restrict_ preg, const char *_Restrict_ pattern, int cflags)
 
   /* We have already checked preg->fastmap != NULL.  */
   if (__glibc_likely (ret == REG_NOERROR))
-    /* Compute the fastmap now, since regexec cannot modify the pattern
-       buffer.  This function never fails in this implementation.  */
-    (void) dm_compile_fastmap (preg);
+    {
+      /* Compute the fastmap now, since regexec cannot modify the pattern
+	 buffer.  This function never fails in this implementation.  */
+      (void) dm_compile_fastmap (preg);
+
+      /* Build the whole DFA now if asked to.  When that fails, searches
+	 build the rest of it lazily as usual.  If no search of the
+	 pattern keeps a state log, the matcher only sees how the states
+	 halt and move, so the equivalent ones can be merged.  The states
+	 built then end up in a single block.  */
+      if (cflags & REG_DFA_EAGER)
+	{
+	  re_dfa_t *dfa = preg->buffer;
+	  unsigned long long stamp = re_profile_clock ();
+	  if (re_dfa_materialize (dfa, RE_DFA_EAGER_MAX_STATES))
+	    {
+	      if (!dfa->has_mb_node && (preg->no_sub || preg->re_nsub == 0))
+		re_dfa_minimize (dfa);
+	      re_dfa_pack_eager (dfa);
+	    }
+	  re_profile_add (&dfa->profile.materialize, &stamp);
+	}
+    }
   else
     {
       /* Some error occurred while compiling the expression.  */
@@ -623,7 +758,20 @@ const bitset_t utf8_sb_map =
 static void
 free_dfa_content (re_dfa_t *dfa)
 {
-  Idx i, j;
+  Idx i;
+
+  /* A shard owns only its cache, see reg_dfa_shard.  */
+  if (dfa->master != NULL)
+    {
+      if (dfa->state_table)
+	for (i = 0; i <= (Idx)dfa->state_hash_mask; ++i)
+	  if (dfa->state_table[i].state != NULL
+	      && !dfa->state_table[i].state->materialized)
+	    free_state (dfa->state_table[i].state);
+      re_free (dfa->state_table);
+      re_free (dfa);
+      return;
+    }
 
   if (dfa->nodes)
     for (i = 0; i < (Idx)dfa->nodes_len; ++i)
@@ -645,21 +793,29 @@ free_dfa_content (re_dfa_t *dfa)
 
   if (dfa->state_table)
     for (i = 0; i <= (Idx)dfa->state_hash_mask; ++i)
-      {
-	struct re_state_table_entry *entry = dfa->state_table + i;
-	for (j = 0; j < entry->num; ++j)
-	  {
-	    re_dfastate_t *state = entry->array[j];
-	    free_state (state);
-	  }
-	re_free (entry->array);
-      }
+      if (dfa->state_table[i].state != NULL)
+	free_state (dfa->state_table[i].state);
   re_free (dfa->state_table);
+  re_free (dfa->eager_states);
+  re_free (dfa->eager_block);
+  re_free (dfa->eager_trtables);
 #ifdef RE_ENABLE_I18N
   if (dfa->sb_char != utf8_sb_map)
     re_free (dfa->sb_char);
 #endif
   re_free (dfa->subexp_map);
+  if (dfa->pure_lit != NULL)
+    {
+      re_free (dfa->pure_lit->bytes);
+      re_free (dfa->pure_lit->border);
+      re_free (dfa->pure_lit);
+    }
+  re_free (dfa->rev_pattern);
+  if (dfa->reverse != NULL)
+    {
+      regfree (dfa->reverse);
+      re_free (dfa->reverse);
+    }
 #ifdef DEBUG
   re_free (dfa->re_str);
 #endif
@@ -674,6 +830,7 @@ void
 regfree (regex_t *preg)
 {
   re_dfa_t *dfa = preg->buffer;
+  bool shard = dfa != NULL && dfa->master != NULL;
   if (__glibc_likely (dfa != NULL))
     {
       lock_fini (dfa->lock);
@@ -686,7 +843,9 @@ regfree (regex_t *preg)
   re_free (preg->fastmap);
   preg->fastmap = NULL;
 
-  re_free (preg->translate);
+  /* A shard shares the translate table of its master.  */
+  if (!shard)
+    re_free (preg->translate);
   preg->translate = NULL;
 }
 #ifdef _LIBC
@@ -695,6 +854,295 @@ libc_hidden_def (__regfree)
 weak_alias (__regfree, regfree)
 #endif
 
+/* Make SHARD a copy of PREG that shares the NFA, the translate table and
+   the DFA states built for REG_DFA_EAGER, but caches the states of the
+   lazy DFA apart.  PREG is copied under its lock, as its searches add to
+   the cache; the fields of the copy that describe the cache then start
+   afresh.  Sharing the translate table keeps the fastmap scan of the
+   copy, which is chosen by its address, see scan_fastmap.  */
+
+int
+reg_dfa_shard (const regex_t *preg, regex_t *shard)
+{
+  re_dfa_t *dfa = preg->buffer;
+  re_dfa_t *sdfa;
+  char *fastmap = NULL;
+  reg_errcode_t err;
+
+  if (__glibc_unlikely (dfa == NULL || dfa->init_state == NULL))
+    return REG_BADPAT;
+
+  sdfa = re_malloc_tag (re_dfa_t, 1, REG_MEM_COMPILE);
+  if (preg->fastmap != NULL)
+    fastmap = re_malloc (char, SBC_MAX);
+  if (__glibc_unlikely (sdfa == NULL
+			|| (preg->fastmap != NULL && fastmap == NULL)))
+    {
+      re_free (sdfa);
+      re_free (fastmap);
+      return REG_ESPACE;
+    }
+
+  lock_lock (dfa->lock);
+  memcpy (sdfa, dfa, sizeof (re_dfa_t));
+  *shard = *preg;
+  if (fastmap != NULL)
+    memcpy (fastmap, preg->fastmap, SBC_MAX);
+  lock_unlock (dfa->lock);
+
+  shard->buffer = sdfa;
+  shard->allocated = sizeof (re_dfa_t);
+  shard->fastmap = fastmap;
+  shard->regs_allocated = REGS_UNALLOCATED;
+
+  sdfa->master = dfa->master != NULL ? dfa->master : dfa;
+  sdfa->state_table = NULL;
+  memset (&sdfa->stats, '\0', sizeof (reg_stats_t));
+  sdfa->limit_waived = 0;
+  sdfa->nshared = 0;
+  sdfa->flush_pending = false;
+  err = re_dfa_init_shard (sdfa);
+  /* The initial states of a complete DFA are among those it shares.  */
+  if (err == REG_NOERROR && !sdfa->materialized)
+    err = acquire_initial_states (sdfa, dfa->init_state->entrance_nodes);
+  if (err == REG_NOERROR && lock_init (sdfa->lock) != 0)
+    err = REG_ESPACE;
+  if (__glibc_unlikely (err != REG_NOERROR))
+    {
+      free_dfa_content (sdfa);
+      re_free (fastmap);
+      shard->buffer = NULL;
+      shard->allocated = 0;
+      shard->fastmap = NULL;
+      shard->translate = NULL;
+      return err;
+    }
+  return REG_NOERROR;
+}
+
+/* Keep PATTERN, of LENGTH bytes, for re_compile_reverse if
+   find_leftmost_start may ever run for DFA: a failed attempt of the
+   pattern may read to the end of the text, as it loops, and the search
+   is neither anchored nor for a plain literal.  Other patterns read a
+   bounded number of bytes from each start and do not pay for the copy.
+   Without it the matcher only runs forward, so a failed allocation is
+   not an error.  */
+
+static void
+keep_reverse_pattern (re_dfa_t *dfa, const regex_t *preg,
+		      const char *pattern, size_t length)
+{
+  Idx i;
+
+  /* The test of plan_search in regexec.c.  */
+  if (dfa->pure_lit != NULL
+      || (dfa->init_state->nodes.nelem == 0
+	  && dfa->init_state_word->nodes.nelem == 0
+	  && (dfa->init_state_nl->nodes.nelem == 0
+	      || !preg->newline_anchor)))
+    return;
+  for (i = 0; i < (Idx) dfa->nodes_len; ++i)
+    if (dfa->nodes[i].type == OP_DUP_ASTERISK)
+      break;
+  if (i == (Idx) dfa->nodes_len)
+    return;
+
+  dfa->rev_pattern = re_malloc_tag (char, length + 1, REG_MEM_COMPILE);
+  if (dfa->rev_pattern != NULL)
+    {
+      memcpy (dfa->rev_pattern, pattern, length);
+      dfa->rev_pattern_len = length;
+    }
+}
+
+/* Compile into *REVERSE the pattern of PREG, kept by its master DFA, to
+   match the reversed text, see parse_reverse_prefix.  The longest match
+   of *REVERSE from the end of the text ends where the leftmost match of
+   PREG starts; find_leftmost_start in regexec.c runs it.
+
+   *REVERSE takes the cache budget and the limits of reg_set_dfa_limit
+   that the master has now, but never calls its callback: the user sees
+   only the states of PREG.  Over a limit the reversed search fails, and
+   find_leftmost_start leaves the search to the forward attempts.  */
+
+reg_errcode_t
+re_compile_reverse (const regex_t *preg, regex_t **reverse)
+{
+  const re_dfa_t *dfa = preg->buffer;
+  regex_t *rev;
+  re_dfa_t *rdfa;
+  reg_errcode_t err;
+
+  if (dfa->master != NULL)
+    dfa = dfa->master;
+  if (__glibc_unlikely (dfa->rev_pattern == NULL))
+    return REG_BADPAT;
+
+  rev = re_malloc_tag (regex_t, 1, REG_MEM_COMPILE);
+  if (__glibc_unlikely (rev == NULL))
+    return REG_ESPACE;
+  memset (rev, '\0', sizeof (regex_t));
+  rev->newline_anchor = preg->newline_anchor;
+  rev->no_sub = 1;
+  rev->fl_longest_match = 2;
+  if (preg->translate != NULL)
+    {
+      rev->translate = re_malloc (unsigned char, SBC_MAX);
+      if (__glibc_unlikely (rev->translate == NULL))
+	{
+	  re_free (rev);
+	  return REG_ESPACE;
+	}
+      memcpy (rev->translate, preg->translate, SBC_MAX);
+    }
+
+  err = re_compile_internal (rev, dfa->rev_pattern, dfa->rev_pattern_len,
+			     dfa->syntax, true);
+  if (__glibc_unlikely (err != REG_NOERROR))
+    {
+      re_free (rev->translate);
+      re_free (rev);
+      return err;
+    }
+  /* The leftmost start is the end of the longest reversed match, even
+     if PREG takes the shortest one.  */
+  rev->fl_longest_match = 1;
+  rdfa = rev->buffer;
+  rdfa->cache_budget = dfa->cache_budget;
+  rdfa->max_states = dfa->max_states;
+  rdfa->max_trtable_bytes = dfa->max_trtable_bytes;
+  *reverse = rev;
+  return REG_NOERROR;
+}
+
+/* Return the bytes owned by the token NODE, see free_token.  */
+
+static size_t
+token_mem_usage (const re_token_t *node)
+{
+#ifdef RE_ENABLE_I18N
+  if (node->type == COMPLEX_BRACKET && node->duplicated == 0)
+    {
+      const re_charset_t *cset = node->opr.mbcset;
+      return (sizeof (re_charset_t)
+	      + cset->nmbchars * sizeof (wchar_t)
+# ifdef _LIBC
+	      + cset->ncoll_syms * sizeof (int32_t)
+	      + cset->nequiv_classes * sizeof (int32_t)
+# endif
+	      + cset->nranges * 2 * sizeof (cset->range_starts[0])
+	      + cset->nchar_classes * sizeof (wctype_t));
+    }
+  else
+#endif /* RE_ENABLE_I18N */
+    if (node->type == SIMPLE_BRACKET && node->duplicated == 0)
+      return sizeof (bitset_t);
+  return 0;
+}
+
+/* Store in USAGE the bytes held by PREG.  The walk follows
+   free_dfa_content; it takes the DFA lock since the matcher adds states
+   and transition tables.  */
+
+int
+reg_get_mem_usage (const regex_t *preg, reg_mem_usage_t *usage)
+{
+  re_dfa_t *dfa = preg->buffer;
+  Idx i;
+
+  memset (usage, '\0', sizeof (reg_mem_usage_t));
+  if (__glibc_unlikely (dfa == NULL))
+    return REG_BADPAT;
+
+  lock_lock (dfa->lock);
+  /* A shard shares the NFA with its master, see reg_dfa_shard.  */
+  if (dfa->master == NULL)
+    {
+      usage->nodes = dfa->nodes_alloc * sizeof (re_token_t);
+      for (i = 0; i < (Idx)dfa->nodes_len; ++i)
+	usage->nodes += token_mem_usage (dfa->nodes + i);
+
+      if (dfa->nexts != NULL)
+	usage->node_sets += dfa->nodes_alloc * sizeof (Idx);
+      if (dfa->org_indices != NULL)
+	usage->node_sets += dfa->nodes_alloc * sizeof (Idx);
+      if (dfa->edests != NULL)
+	usage->node_sets += dfa->nodes_alloc * sizeof (re_node_set);
+      if (dfa->eclosures != NULL)
+	usage->node_sets += dfa->nodes_alloc * sizeof (re_node_set);
+      if (dfa->inveclosures != NULL)
+	usage->node_sets += dfa->nodes_len * sizeof (re_node_set);
+      for (i = 0; i < (Idx)dfa->nodes_len; ++i)
+	{
+	  if (dfa->edests != NULL)
+	    usage->node_sets += re_node_set_heap_size (&dfa->edests[i]);
+	  if (dfa->eclosures != NULL)
+	    usage->node_sets += re_node_set_heap_size (&dfa->eclosures[i]);
+	  if (dfa->inveclosures != NULL)
+	    usage->node_sets += re_node_set_heap_size (&dfa->inveclosures[i]);
+	}
+    }
+
+  if (dfa->state_table != NULL)
+    {
+      usage->state_table = ((dfa->state_hash_mask + 1)
+			    * sizeof (struct re_state_table_entry));
+      for (i = 0; i <= (Idx)dfa->state_hash_mask; ++i)
+	{
+	  const re_dfastate_t *state = dfa->state_table[i].state;
+	  if (state == NULL || (dfa->master != NULL && state->materialized))
+	    continue;
+	  usage->states += calc_state_size (state);
+	  if (state->trtable != NULL || state->word_trtable != NULL
+	      || state->eager_trtable != NULL)
+	    {
+	      usage->trtables += calc_trtable_size (dfa, state);
+	      ++usage->ntrtables;
+	    }
+	  ++usage->nstates;
+	}
+    }
+  /* Slot 0 of the packed REG_DFA_EAGER states stands for no state.  */
+  if (dfa->master == NULL && dfa->eager_block != NULL)
+    usage->states += sizeof (re_dfastate_t);
+
+  usage->other = sizeof (re_dfa_t);
+  if (preg->fastmap != NULL)
+    usage->other += SBC_MAX;
+  if (dfa->master == NULL)
+    {
+      if (preg->translate != NULL)
+	usage->other += SBC_MAX;
+#ifdef RE_ENABLE_I18N
+      if (dfa->sb_char != NULL && dfa->sb_char != utf8_sb_map)
+	usage->other += sizeof (bitset_t);
+#endif
+      if (dfa->subexp_map != NULL)
+	usage->other += preg->re_nsub * sizeof (Idx);
+      usage->other += dfa->neager_states * sizeof (re_dfastate_t *);
+      if (dfa->pure_lit != NULL)
+	usage->other += (sizeof (re_pure_literal_t) + dfa->pure_lit->len
+			 + (dfa->pure_lit->len + 1) * sizeof (Idx));
+      if (dfa->rev_pattern != NULL)
+	usage->other += dfa->rev_pattern_len + 1;
+      if (dfa->reverse != NULL)
+	{
+	  reg_mem_usage_t rev_usage;
+	  if (reg_get_mem_usage (dfa->reverse, &rev_usage) == REG_NOERROR)
+	    usage->other += sizeof (regex_t) + rev_usage.total;
+	}
+#ifdef DEBUG
+      if (dfa->re_str != NULL)
+	usage->other += strlen (dfa->re_str) + 1;
+#endif
+    }
+  lock_unlock (dfa->lock);
+
+  usage->total = (usage->nodes + usage->node_sets + usage->state_table
+		  + usage->states + usage->trtables + usage->other);
+  return REG_NOERROR;
+}
+
 /***********************************************
 Purpose:
 ñ뻷
@@ -913,7 +1361,8 @@ re_comp (const char *s)
   /* Match anchors at newlines.  */
   re_comp_buf.newline_anchor = 1;
 
-  ret = re_compile_internal (&re_comp_buf, s, strlen (s), re_syntax_options);
+  ret = re_compile_internal (&re_comp_buf, s, strlen (s), re_syntax_options,
+			     false);
 
   if (!ret)
     return NULL;
@@ -931,17 +1380,81 @@ libc_freeres_fn (free_mem)
 
 #endif /* _REGEX_RE_COMP */
 
+/* Timing of the compilation phases, switched on for the whole process by
+   reg_set_compile_profile.  */
+
+static int re_compile_profiling;
+
+void
+reg_set_compile_profile (int flag)
+{
+  re_compile_profiling = flag != 0;
+}
+
+int
+reg_get_compile_profile (const regex_t *preg, reg_compile_profile_t *profile)
+{
+  re_dfa_t *dfa = preg->buffer;
+
+  if (__glibc_unlikely (dfa == NULL))
+    return REG_BADPAT;
+
+  /* re_search_stub may recompute the fastmap concurrently.  */
+  lock_lock (dfa->lock);
+  *profile = dfa->profile;
+  lock_unlock (dfa->lock);
+  return REG_NOERROR;
+}
+
+/* Return a time stamp in nanoseconds, or 0 if profiling is disabled.
+   The stamp is monotonic where CLOCK_MONOTONIC is; elsewhere it is the
+   calendar time, which may be set back.  */
+
+static unsigned long long
+re_profile_clock (void)
+{
+  struct timespec ts;
+
+  if (__glibc_likely (!re_compile_profiling))
+    return 0;
+#ifdef CLOCK_MONOTONIC
+  if (clock_gettime (CLOCK_MONOTONIC, &ts) != 0)
+#endif
+    timespec_get (&ts, TIME_UTC);
+  return (unsigned long long) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Add the time elapsed since *STAMP to *PHASE, and restart *STAMP.  Do
+   nothing if profiling was off when *STAMP was taken.  A clock set back
+   meanwhile adds nothing rather than wrapping around.  */
+
+static void
+re_profile_add (unsigned long long *phase, unsigned long long *stamp)
+{
+  unsigned long long now;
+
+  if (__glibc_likely (*stamp == 0))
+    return;
+  now = re_profile_clock ();
+  if (now > *stamp)
+    *phase += now - *stamp;
+  *stamp = now;
+}
+
 /* Internal entry point.
    Compile the regular expression PATTERN, whose length is LENGTH.
-   SYNTAX indicate regular expression's syntax.  */
+   SYNTAX indicate regular expression's syntax.  If REVERSED, compile
+   it to match the reversed text, see re_compile_reverse.  */
 
 static reg_errcode_t
 re_compile_internal (regex_t *preg, const char * pattern, size_t length,
-		     reg_syntax_t syntax)
+		     reg_syntax_t syntax, bool reversed)
 {
   reg_errcode_t err = REG_NOERROR;
   re_dfa_t *dfa;
   re_string_t regexp;
+  unsigned long long start, stamp;
+  bool reversible;
 
   /* Initialize the pattern buffer.  */
   preg->fastmap_accurate = 0;
@@ -960,7 +1473,7 @@ re_compile_internal (regex_t *preg, const char * pattern, size_t length,
 	 enough space.  This loses if buffer's address is bogus, but
 	 that is the user's responsibility.  If ->buffer is NULL this
 	 is a simple allocation.  */
-      dfa = re_realloc (preg->buffer, re_dfa_t, 1);
+      dfa = re_realloc_tag (preg->buffer, re_dfa_t, 1, REG_MEM_COMPILE);
       if (dfa == NULL)
 	return REG_ESPACE;
       preg->allocated = sizeof (re_dfa_t);
@@ -968,6 +1481,7 @@ re_compile_internal (regex_t *preg, const char * pattern, size_t length,
     }
   preg->used = sizeof (re_dfa_t);
 
+  start = stamp = re_profile_clock ();
   err = init_dfa (dfa, length);
   if (__glibc_unlikely (err == REG_NOERROR && lock_init (dfa->lock) != 0))
     err = REG_ESPACE;
@@ -978,9 +1492,10 @@ re_compile_internal (regex_t *preg, const char * pattern, size_t length,
       preg->allocated = 0;
       return err;
     }
+  dfa->reversed = reversed;
 #ifdef DEBUG
   /* Note: length+1 will not overflow since it is checked in init_dfa.  */
-  dfa->re_str = re_malloc (char, length + 1);
+  dfa->re_str = re_malloc_tag (char, length + 1, REG_MEM_COMPILE);
   strncpy (dfa->re_str, pattern, length);
   dfa->re_str[length] = 0;
 #endif
@@ -998,26 +1513,43 @@ re_compile_internal (regex_t *preg, const char * pattern, size_t length,
       preg->allocated = 0;
       return err;
     }
+  re_profile_add (&dfa->profile.init, &stamp);
 
   /* Parse the regular expression, and build a structure tree.  */
   preg->re_nsub = 0;
   dfa->str_tree = parse (&regexp, preg, syntax, &err);
   if (__glibc_unlikely (dfa->str_tree == NULL))
     goto re_compile_internal_free_return;
+  re_profile_add (&dfa->profile.parse, &stamp);
 
   /* Analyze the tree and create the nfa.  */
   err = analyze (preg);
   if (__glibc_unlikely (err != REG_NOERROR))
     goto re_compile_internal_free_return;
+  re_profile_add (&dfa->profile.analyze, &stamp);
+  calc_required_literal (dfa, preg);
+
+  /* Reversing the text would split its multibyte characters, and back
+     references cannot be matched backward.  */
+  reversible = (dfa->mb_cur_max == 1 && dfa->nbackref == 0
+		&& !reversed);
 
 #ifdef RE_ENABLE_I18N
   /* If possible, do searching in single byte encoding to speed things up.  */
   if (dfa->is_utf8 && !(syntax & RE_ICASE) && preg->translate == NULL)
     optimize_utf8 (dfa);
+  re_profile_add (&dfa->profile.optimize_utf8, &stamp);
 #endif
+  calc_pure_literal (dfa, preg);
 
   /* Then create the initial state of the dfa.  */
   err = create_initial_state (dfa);
+  re_profile_add (&dfa->profile.create_initial_state, &stamp);
+  if (err == REG_NOERROR && reversible)
+    keep_reverse_pattern (dfa, preg, pattern, length);
+  calc_byte_classes (dfa);
+  dfa->profile.nnodes = dfa->nodes_len;
+  re_profile_add (&dfa->profile.total, &start);
 
   /* Release work areas.  */
   free_workarea_compile (preg);
@@ -1071,7 +1603,7 @@ init_dfa (re_dfa_t *dfa, size_t pat_len)
     return REG_ESPACE;
 
   dfa->nodes_alloc = pat_len + 1;
-  dfa->nodes = re_malloc (re_token_t, dfa->nodes_alloc);
+  dfa->nodes = re_malloc_tag (re_token_t, dfa->nodes_alloc, REG_MEM_COMPILE);
 
   /*  table_size = 2 ^ ceil(log pat_len) */
   for (table_size = 1; ; table_size <<= 1)
@@ -1080,7 +1612,8 @@ init_dfa (re_dfa_t *dfa, size_t pat_len)
       break;
   }
 
-  dfa->state_table = re_calloc (sizeof (struct re_state_table_entry), table_size);
+  dfa->state_table = re_calloc_tag (sizeof (struct re_state_table_entry),
+				    table_size, REG_MEM_DFA_STATES);
   dfa->state_hash_mask = table_size - 1;
 
   dfa->mb_cur_max = MB_CUR_MAX;
@@ -1126,7 +1659,8 @@ init_dfa (re_dfa_t *dfa, size_t pat_len)
 	{
 	  int i, j, ch;
 
-	  dfa->sb_char = (re_bitset_ptr_t) re_calloc (sizeof (bitset_t), 1);
+	  dfa->sb_char = (re_bitset_ptr_t) re_calloc_tag (sizeof (bitset_t), 1,
+							  REG_MEM_COMPILE);
 	  if (__glibc_unlikely (dfa->sb_char == NULL))
 	    return REG_ESPACE;
 
@@ -1222,6 +1756,414 @@ free_workarea_compile (regex_t *preg)
   dfa->org_indices = NULL;
 }
 
+/* Split the bytes into the classes the DFA cannot tell apart: the bytes
+   of a class are all accepted or all rejected by every node, and agree on
+   being newlines and word characters, so build_trtable gives them the
+   same transition.  */
+
+static void
+calc_byte_classes (re_dfa_t *dfa)
+{
+  bitset_t classes[SBC_MAX], chars;
+  const bitset_word_t *last_set = NULL;
+  Idx node;
+  unsigned char byte_class[SBC_MAX];
+  int nclasses = 1, nbyte_classes = 0, cls, filler, i, ch;
+#ifdef RE_ENABLE_I18N
+  bool has_utf8_period = false;
+#endif
+
+  /* A byte a CHARACTER node matches is a class by itself; so are the
+     newline and the null byte, which periods may reject.  They are kept
+     apart from the other bytes first, and numbered one by one below.  */
+  bitset_empty (chars);
+  bitset_set (chars, '\n');
+  bitset_set (chars, '\0');
+  for (node = 0; node < (Idx)dfa->nodes_len; ++node)
+    if (dfa->nodes[node].type == CHARACTER)
+      bitset_set (chars, dfa->nodes[node].opr.c);
+  bitset_set_all (classes[0]);
+  nclasses = split_byte_classes (classes, nclasses, chars);
+
+  /* Duplicated subexpressions repeat the same brackets.  */
+  for (node = 0; node < (Idx)dfa->nodes_len; ++node)
+    if (dfa->nodes[node].type == SIMPLE_BRACKET)
+      {
+	const bitset_word_t *set = dfa->nodes[node].opr.sbcset;
+	if (last_set == NULL || memcmp (set, last_set, sizeof (bitset_t)) != 0)
+	  nclasses = split_byte_classes (classes, nclasses, set);
+	last_set = set;
+      }
+#ifdef RE_ENABLE_I18N
+    else if (dfa->nodes[node].type == OP_UTF8_PERIOD)
+      has_utf8_period = true;
+  if (has_utf8_period)
+    nclasses = split_byte_classes (classes, nclasses, utf8_sb_map);
+  if (dfa->mb_cur_max > 1)
+    nclasses = split_byte_classes (classes, nclasses, dfa->sb_char);
+#endif
+  if (dfa->word_ops_used)
+    nclasses = split_byte_classes (classes, nclasses, dfa->word_char);
+
+  /* Number the sets, which lie either inside CHARS or apart from it;
+     every byte of CHARS gets a number of its own.  The set of the last
+     byte, usually the largest, is stored with memset and skipped by the
+     bit by bit loop.  */
+  filler = -1;
+  if (!bitset_contain (chars, SBC_MAX - 1))
+    {
+      for (filler = 0; !bitset_contain (classes[filler], SBC_MAX - 1);
+	   ++filler)
+	;
+      memset (byte_class, nbyte_classes++, SBC_MAX);
+    }
+  for (cls = 0; cls < nclasses; ++cls)
+    {
+      int id = nbyte_classes;
+      bool single = false;
+      if (cls == filler)
+	continue;
+      for (i = 0; i < BITSET_WORDS; ++i)
+	single |= (classes[cls][i] & chars[i]) != 0;
+      if (!single)
+	++nbyte_classes;
+      for (i = 0; i < BITSET_WORDS; ++i)
+	{
+	  bitset_word_t elem = classes[cls][i];
+	  for (ch = i * BITSET_WORD_BITS; elem; ++ch, elem >>= 1)
+	    {
+	      while ((elem & 0xff) == 0)
+		{
+		  elem >>= 8;
+		  ch += 8;
+		}
+	      if (elem & 1)
+		byte_class[ch] = single ? nbyte_classes++ : id;
+	    }
+	}
+    }
+  memcpy (dfa->byte_class, byte_class, SBC_MAX);
+  dfa->nbyte_classes = nbyte_classes;
+}
+
+/* Split each of the NCLASSES byte sets in CLASSES into its bytes in SET
+   and the others, and return the new number of sets.  */
+
+static int
+split_byte_classes (bitset_t *classes, int nclasses, const bitset_t set)
+{
+  int cls, n = nclasses, i;
+
+  for (cls = 0; cls < nclasses; ++cls)
+    {
+      bitset_word_t in = 0, out = 0;
+      for (i = 0; i < BITSET_WORDS; ++i)
+	{
+	  in |= classes[cls][i] & set[i];
+	  out |= classes[cls][i] & ~set[i];
+	}
+      if (in && out)
+	{
+	  for (i = 0; i < BITSET_WORDS; ++i)
+	    {
+	      classes[n][i] = classes[cls][i] & ~set[i];
+	      classes[cls][i] &= set[i];
+	    }
+	  ++n;
+	}
+    }
+  return n;
+}
+
+/* What calc_req_lit knows of a subtree: every match of it starts with
+   PRE, ends with SUF and contains BEST.  EXACT means that PRE is the
+   only string it matches; SUF is then PRE as well.  Literals longer
+   than RE_REQ_LIT_MAX are cut, which keeps them required.  */
+
+typedef struct
+{
+  bool exact;
+  Idx pre_len, suf_len, best_len;
+  unsigned char pre[RE_REQ_LIT_MAX];
+  unsigned char suf[RE_REQ_LIT_MAX];
+  unsigned char best[RE_REQ_LIT_MAX];
+} req_lit_t;
+
+/* Nesting of groups, alternations and repetitions calc_req_lit looks
+   into; deeper subtrees are taken to require nothing.  */
+#define RE_REQ_LIT_DEPTH 64
+
+static void
+req_lit_set (req_lit_t *info, bool exact)
+{
+  info->exact = exact;
+  info->pre_len = info->suf_len = info->best_len = 0;
+}
+
+/* Make LIT, LEN bytes long, the BEST of INFO if it is longer.  */
+
+static void
+req_lit_offer (req_lit_t *info, const unsigned char *lit, Idx len)
+{
+  if (len > RE_REQ_LIT_MAX)
+    len = RE_REQ_LIT_MAX;
+  if (len > info->best_len)
+    {
+      memcpy (info->best, lit, len);
+      info->best_len = len;
+    }
+}
+
+/* Make A what A followed by B requires.  */
+
+static void
+req_lit_concat (req_lit_t *a, const req_lit_t *b)
+{
+  unsigned char join[2 * RE_REQ_LIT_MAX];
+  Idx len = a->suf_len + b->pre_len;
+
+  /* Where a match of A ends, a match of B starts.  */
+  memcpy (join, a->suf, a->suf_len);
+  memcpy (join + a->suf_len, b->pre, b->pre_len);
+  if (a->exact)
+    {
+      a->pre_len = MIN (len, RE_REQ_LIT_MAX);
+      memcpy (a->pre, join, a->pre_len);
+    }
+  if (b->exact)
+    {
+      a->suf_len = MIN (len, RE_REQ_LIT_MAX);
+      memcpy (a->suf, join + len - a->suf_len, a->suf_len);
+    }
+  else
+    {
+      a->suf_len = b->suf_len;
+      memcpy (a->suf, b->suf, b->suf_len);
+    }
+  a->exact = a->exact && b->exact && len <= RE_REQ_LIT_MAX;
+  req_lit_offer (a, join, len);
+  req_lit_offer (a, b->best, b->best_len);
+  req_lit_offer (a, a->pre, a->pre_len);
+  req_lit_offer (a, a->suf, a->suf_len);
+}
+
+/* Make A what a match of either A or B requires: the start they share
+   and the end they share.  */
+
+static void
+req_lit_alt (req_lit_t *a, const req_lit_t *b)
+{
+  Idx pre_len = 0, suf_len = 0;
+
+  while (pre_len < a->pre_len && pre_len < b->pre_len
+	 && a->pre[pre_len] == b->pre[pre_len])
+    ++pre_len;
+  while (suf_len < a->suf_len && suf_len < b->suf_len
+	 && (a->suf[a->suf_len - 1 - suf_len]
+	     == b->suf[b->suf_len - 1 - suf_len]))
+    ++suf_len;
+  a->exact = (a->exact && b->exact
+	      && pre_len == a->pre_len && pre_len == b->pre_len);
+  a->pre_len = pre_len;
+  memmove (a->suf, a->suf + a->suf_len - suf_len, suf_len);
+  a->suf_len = suf_len;
+  a->best_len = 0;
+  req_lit_offer (a, a->pre, a->pre_len);
+  req_lit_offer (a, a->suf, a->suf_len);
+}
+
+/* Find what the matches of the subtree NODE, at nesting DEPTH, require.
+   The CONCATs of a branch nest to the left, one per element, so they are
+   walked with a loop rather than recursion.  */
+
+static void
+calc_req_lit (const bin_tree_t *node, req_lit_t *info, int depth)
+{
+  req_lit_t other;
+
+  if (node == NULL)
+    {
+      req_lit_set (info, true);
+      return;
+    }
+  if (depth > RE_REQ_LIT_DEPTH)
+    {
+      req_lit_set (info, false);
+      return;
+    }
+  switch (node->token.type)
+    {
+    case CONCAT:
+      calc_req_lit (node->right, info, depth + 1);
+      for (node = node->left; node != NULL && node->token.type == CONCAT;
+	   node = node->left)
+	{
+	  calc_req_lit (node->right, &other, depth + 1);
+	  req_lit_concat (&other, info);
+	  *info = other;
+	}
+      calc_req_lit (node, &other, depth + 1);
+      req_lit_concat (&other, info);
+      *info = other;
+      break;
+
+    case SUBEXP:
+      calc_req_lit (node->left, info, depth + 1);
+      break;
+
+    case OP_ALT:
+      calc_req_lit (node->left, info, depth + 1);
+      calc_req_lit (node->right, &other, depth + 1);
+      req_lit_alt (info, &other);
+      break;
+
+    case CHARACTER:
+      req_lit_set (info, true);
+      info->pre[0] = info->suf[0] = info->best[0] = node->token.opr.c;
+      info->pre_len = info->suf_len = info->best_len = 1;
+      break;
+
+    case ANCHOR:
+    case OP_OPEN_SUBEXP:
+    case OP_CLOSE_SUBEXP:
+    case END_OF_RE:
+      /* These match the empty string.  */
+      req_lit_set (info, true);
+      break;
+
+    default:
+      req_lit_set (info, false);
+      break;
+    }
+}
+
+/* Find a literal every match of the pattern contains, for
+   re_search_internal to look for before running the DFA.  A prefix of
+   every match is preferred, since the search can then jump to it, unless
+   a literal twice as long is found elsewhere.  Literals of one byte are
+   left to the fastmap.  With a translate table the bytes of the pattern
+   need not be those of the matched text, so nothing is searched for.  */
+
+static void
+calc_required_literal (re_dfa_t *dfa, const regex_t *preg)
+{
+  req_lit_t info;
+
+  dfa->req_len = 0;
+  dfa->req_at_start = 0;
+  if (preg->translate != NULL || (preg->syntax & RE_ICASE))
+    return;
+  calc_req_lit (dfa->str_tree, &info, 0);
+  if (info.pre_len >= 2 && 2 * info.pre_len >= info.best_len)
+    {
+      memcpy (dfa->req_lit, info.pre, info.pre_len);
+      dfa->req_len = info.pre_len;
+      dfa->req_at_start = 1;
+    }
+  else if (info.best_len >= 2)
+    {
+      memcpy (dfa->req_lit, info.best, info.best_len);
+      dfa->req_len = info.best_len;
+    }
+}
+
+/* What calc_pure_literal_iter has seen: the LEN bytes of the literal,
+   stored in BYTES unless it is NULL.  */
+
+typedef struct
+{
+  unsigned char *bytes;
+  Idx len;
+} pure_lit_walk_t;
+
+static reg_errcode_t
+calc_pure_literal_iter (void *extra, bin_tree_t *node)
+{
+  pure_lit_walk_t *walk = (pure_lit_walk_t *) extra;
+
+  switch (node->token.type)
+    {
+    case CHARACTER:
+      if (walk->bytes != NULL)
+	walk->bytes[walk->len] = node->token.opr.c;
+      ++walk->len;
+      return REG_NOERROR;
+
+    case CONCAT:
+    case END_OF_RE:
+      return REG_NOERROR;
+
+    default:
+      return REG_NOMATCH;
+    }
+}
+
+/* If the pattern matches a single string, as "abc" or "a\.b" do, keep
+   it for find_pure_literal, which looks for it in the text instead of
+   running the DFA.  The tree then only has characters, which preorder
+   visits in order.  The pattern was read through the translate table
+   and RE_ICASE like the text will be, so its bytes are compared with
+   the bytes of the text through FOLD.  Multibyte texts are left to the
+   DFA, since a character may end with the bytes of another.  Without
+   memory for it the DFA matches the literal too.  */
+
+static void
+calc_pure_literal (re_dfa_t *dfa, const regex_t *preg)
+{
+  RE_TRANSLATE_TYPE t = preg->translate;
+  bool icase = (preg->syntax & RE_ICASE) != 0;
+  re_pure_literal_t *lit;
+  pure_lit_walk_t walk;
+  char first[SBC_MAX];
+  Idx q, k;
+  int c;
+
+  if (dfa->mb_cur_max != 1)
+    return;
+  walk.bytes = NULL;
+  walk.len = 0;
+  if (preorder (dfa->str_tree, calc_pure_literal_iter, &walk) != REG_NOERROR
+      || walk.len == 0)
+    return;
+
+  lit = re_malloc_tag (re_pure_literal_t, 1, REG_MEM_COMPILE);
+  if (__glibc_unlikely (lit == NULL))
+    return;
+  lit->bytes = re_malloc_tag (unsigned char, walk.len, REG_MEM_COMPILE);
+  lit->border = re_malloc_tag (Idx, walk.len + 1, REG_MEM_COMPILE);
+  if (__glibc_unlikely (lit->bytes == NULL || lit->border == NULL))
+    {
+      re_free (lit->bytes);
+      re_free (lit->border);
+      re_free (lit);
+      return;
+    }
+  walk.bytes = lit->bytes;
+  walk.len = 0;
+  (void) preorder (dfa->str_tree, calc_pure_literal_iter, &walk);
+  lit->len = walk.len;
+
+  /* The failure function of Knuth, Morris and Pratt.  */
+  lit->border[0] = lit->border[1] = 0;
+  for (q = 1, k = 0; q < lit->len; ++q)
+    {
+      while (k > 0 && lit->bytes[q] != lit->bytes[k])
+	k = lit->border[k];
+      if (lit->bytes[q] == lit->bytes[k])
+	++k;
+      lit->border[q + 1] = k;
+    }
+
+  for (c = 0; c < SBC_MAX; ++c)
+    {
+      int ch = t ? t[c] : c;
+      lit->fold[c] = icase ? toupper (ch) : ch;
+      first[c] = lit->fold[c] == lit->bytes[0];
+    }
+  calc_fastmap_scan (&lit->first, first, NULL);
+  dfa->pure_lit = lit;
+}
+
 /* Create initial states for all contexts.  */
 
 static reg_errcode_t
@@ -1246,7 +2188,7 @@ create_initial_state (re_dfa_t *dfa)
   if (dfa->nbackref > 0)
     for (i = 0; i < init_nodes.nelem; ++i)
       {
-	Idx node_idx = init_nodes.elems[i];
+	Idx node_idx = re_node_set_elems (&init_nodes)[i];
 	re_token_type_t type = dfa->nodes[node_idx].type;
 
 	Idx clexp_idx;
@@ -1255,7 +2197,8 @@ create_initial_state (re_dfa_t *dfa)
 	for (clexp_idx = 0; clexp_idx < init_nodes.nelem; ++clexp_idx)
 	  {
 	    re_token_t *clexp_node;
-	    clexp_node = dfa->nodes + init_nodes.elems[clexp_idx];
+	    clexp_node = (dfa->nodes
+			  + re_node_set_elems (&init_nodes)[clexp_idx]);
 	    if (clexp_node->type == OP_CLOSE_SUBEXP
 		&& clexp_node->opr.idx == dfa->nodes[node_idx].opr.idx)
 	      break;
@@ -1265,7 +2208,7 @@ create_initial_state (re_dfa_t *dfa)
 
 	if (type == OP_BACK_REF)
 	  {
-	    Idx dest_idx = dfa->edests[node_idx].elems[0];
+	    Idx dest_idx = re_node_set_elems (&dfa->edests[node_idx])[0];
 	    if (!re_node_set_contains (&init_nodes, dest_idx))
 	      {
 		reg_errcode_t merge_err
@@ -1277,19 +2220,32 @@ create_initial_state (re_dfa_t *dfa)
 	  }
       }
 
+  err = acquire_initial_states (dfa, &init_nodes);
+  re_node_set_free (&init_nodes);
+  return err;
+}
+
+/* Acquire the initial states of DFA for all contexts, which hold
+   INIT_NODES.  */
+
+static reg_errcode_t
+acquire_initial_states (re_dfa_t *dfa, const re_node_set *init_nodes)
+{
+  reg_errcode_t err;
+
   /* It must be the first time to invoke acquire_state.  */
-  dfa->init_state = re_acquire_state_context (&err, dfa, &init_nodes, 0);
+  dfa->init_state = re_acquire_state_context (&err, dfa, init_nodes, 0);
   /* We don't check ERR here, since the initial state must not be NULL.  */
   if (__glibc_unlikely (dfa->init_state == NULL))
     return err;
   if (dfa->init_state->has_constraint)
     {
-      dfa->init_state_word = re_acquire_state_context (&err, dfa, &init_nodes,
+      dfa->init_state_word = re_acquire_state_context (&err, dfa, init_nodes,
 						       CONTEXT_WORD);
-      dfa->init_state_nl = re_acquire_state_context (&err, dfa, &init_nodes,
+      dfa->init_state_nl = re_acquire_state_context (&err, dfa, init_nodes,
 						     CONTEXT_NEWLINE);
       dfa->init_state_begbuf = re_acquire_state_context (&err, dfa,
-							 &init_nodes,
+							 init_nodes,
 							 CONTEXT_NEWLINE
 							 | CONTEXT_BEGBUF);
       if (__glibc_unlikely (dfa->init_state_word == NULL
@@ -1301,7 +2257,6 @@ create_initial_state (re_dfa_t *dfa)
     dfa->init_state_word = dfa->init_state_nl
       = dfa->init_state_begbuf = dfa->init_state;
 
-  re_node_set_free (&init_nodes);
   return REG_NOERROR;
 }
 
@@ -1395,17 +2350,19 @@ analyze (regex_t *preg)
 {
   re_dfa_t *dfa = preg->buffer;
   reg_errcode_t ret;
+  unsigned long long stamp = re_profile_clock ();
 
   /* Allocate arrays.  */
-  dfa->nexts = re_malloc (Idx, dfa->nodes_alloc);
-  dfa->org_indices = re_malloc (Idx, dfa->nodes_alloc);
-  dfa->edests = re_malloc (re_node_set, dfa->nodes_alloc);
-  dfa->eclosures = re_malloc (re_node_set, dfa->nodes_alloc);
+  dfa->nexts = re_malloc_tag (Idx, dfa->nodes_alloc, REG_MEM_COMPILE);
+  dfa->org_indices = re_malloc_tag (Idx, dfa->nodes_alloc, REG_MEM_COMPILE);
+  dfa->edests = re_malloc_tag (re_node_set, dfa->nodes_alloc, REG_MEM_COMPILE);
+  dfa->eclosures = re_malloc_tag (re_node_set, dfa->nodes_alloc,
+				  REG_MEM_COMPILE);
   if (__glibc_unlikely (dfa->nexts == NULL || dfa->org_indices == NULL
 			|| dfa->edests == NULL || dfa->eclosures == NULL))
     return REG_ESPACE;
 
-  dfa->subexp_map = re_malloc (Idx, preg->re_nsub);
+  dfa->subexp_map = re_malloc_tag (Idx, preg->re_nsub, REG_MEM_COMPILE);
   if (dfa->subexp_map != NULL)
     {
       Idx i;
@@ -1421,30 +2378,38 @@ analyze (regex_t *preg)
 	  dfa->subexp_map = NULL;
 	}
     }
+  re_profile_add (&dfa->profile.optimize_subexps, &stamp);
 
   ret = postorder (dfa->str_tree, lower_subexps, preg);
   if (__glibc_unlikely (ret != REG_NOERROR))
     return ret;
+  re_profile_add (&dfa->profile.lower_subexps, &stamp);
   ret = postorder (dfa->str_tree, calc_first, dfa);
   if (__glibc_unlikely (ret != REG_NOERROR))
     return ret;
+  re_profile_add (&dfa->profile.calc_first, &stamp);
   preorder (dfa->str_tree, calc_next, dfa);
+  re_profile_add (&dfa->profile.calc_next, &stamp);
   ret = preorder (dfa->str_tree, link_nfa_nodes, dfa);
   if (__glibc_unlikely (ret != REG_NOERROR))
     return ret;
+  re_profile_add (&dfa->profile.link_nfa_nodes, &stamp);
   ret = calc_eclosure (dfa);
   if (__glibc_unlikely (ret != REG_NOERROR))
     return ret;
+  re_profile_add (&dfa->profile.calc_eclosure, &stamp);
 
   /* We only need this during the prune_impossible_nodes pass in regexec.c;
      skip it if p_i_n will not run, as calc_inveclosure can be quadratic.  */
   if ((!preg->no_sub && preg->re_nsub > 0 && dfa->has_plural_match)
       || dfa->nbackref)
     {
-      dfa->inveclosures = re_malloc (re_node_set, dfa->nodes_len);
+      dfa->inveclosures = re_malloc_tag (re_node_set, dfa->nodes_len,
+					 REG_MEM_COMPILE);
       if (__glibc_unlikely (dfa->inveclosures == NULL))
 	return REG_ESPACE;
       ret = calc_inveclosure (dfa);
+      re_profile_add (&dfa->profile.calc_inveclosure, &stamp);
     }
 
   return ret;
@@ -1752,7 +2717,7 @@ duplicate_node_closure (re_dfa_t *dfa, Idx top_org_node, Idx top_clone_node,
 	{
 	  /* In case of the node can epsilon-transit, and it has only one
 	     destination.  */
-	  org_dest = dfa->edests[org_node].elems[0];
+	  org_dest = re_node_set_elems (&dfa->edests[org_node])[0];
 	  re_node_set_empty (dfa->edests + clone_node);
 	  /* If the node is root_node itself, it means the epsilon closure
 	     has a loop.  Then tie it to the destination of the root_node.  */
@@ -1776,7 +2741,7 @@ duplicate_node_closure (re_dfa_t *dfa, Idx top_org_node, Idx top_clone_node,
 	{
 	  /* In case of the node can epsilon-transit, and it has two
 	     destinations. In the bin_tree_t and DFA, that's '|' and '*'.   */
-	  org_dest = dfa->edests[org_node].elems[0];
+	  org_dest = re_node_set_elems (&dfa->edests[org_node])[0];
 	  re_node_set_empty (dfa->edests + clone_node);
 	  /* Search for a duplicated node which satisfies the constraint.  */
 	  clone_dest = search_duplicated_node (dfa, org_dest, constraint);
@@ -1804,7 +2769,7 @@ duplicate_node_closure (re_dfa_t *dfa, Idx top_org_node, Idx top_clone_node,
 		return REG_ESPACE;
 	    }
 
-	  org_dest = dfa->edests[org_node].elems[1];
+	  org_dest = re_node_set_elems (&dfa->edests[org_node])[1];
 	  clone_dest = duplicate_node (dfa, org_dest, constraint);
 	  if (__glibc_unlikely (clone_dest == -1))
 	    return REG_ESPACE;
@@ -1865,7 +2830,7 @@ calc_inveclosure (re_dfa_t *dfa)
 
   for (src = 0; src < (Idx)dfa->nodes_len; ++src)
     {
-      Idx *elems = dfa->eclosures[src].elems;
+      Idx *elems = re_node_set_elems (&dfa->eclosures[src]);
       for (idx = 0; idx < dfa->eclosures[src].nelem; ++idx)
 	{
 	  ok = re_node_set_insert_last (dfa->inveclosures + elems[idx], src);
@@ -1944,7 +2909,7 @@ calc_eclosure_iter (re_node_set *new_set, re_dfa_t *dfa, Idx node, bool root)
      since they must inherit the constraints.  */
   if (dfa->nodes[node].constraint
       && dfa->edests[node].nelem
-      && !dfa->nodes[dfa->edests[node].elems[0]].duplicated)
+      && !dfa->nodes[re_node_set_elems (&dfa->edests[node])[0]].duplicated)
     {
       err = duplicate_node_closure (dfa, node, node, node,
 				    dfa->nodes[node].constraint);
@@ -1957,7 +2922,7 @@ calc_eclosure_iter (re_node_set *new_set, re_dfa_t *dfa, Idx node, bool root)
     for (i = 0; i < dfa->edests[node].nelem; ++i)
       {
 	re_node_set eclosure_elem;
-	Idx edest = dfa->edests[node].elems[i];
+	Idx edest = re_node_set_elems (&dfa->edests[node])[i];
 	/* If calculating the epsilon closure of 'edest' is in progress,
 	   return intermediate result.  */
 	if (dfa->eclosures[edest].nelem == -1)
@@ -2371,6 +3336,12 @@ parse (re_string_t *regexp, regex_t *preg, reg_syntax_t syntax,
   tree = parse_reg_exp (regexp, preg, &current_token, syntax, 0, err);
   if (__glibc_unlikely (*err != REG_NOERROR && tree == NULL))
     return NULL;
+  if (dfa->reversed)
+    {
+      tree = parse_reverse_prefix (dfa, tree, err);
+      if (__glibc_unlikely (tree == NULL))
+	return NULL;
+    }
   eor = create_tree (dfa, NULL, NULL, END_OF_RE);
   if (tree != NULL)
     root = create_tree (dfa, tree, eor, CONCAT);
@@ -2384,6 +3355,52 @@ parse (re_string_t *regexp, regex_t *preg, reg_syntax_t syntax,
   return root;
 }
 
+/* Put in front of TREE, the reversed pattern, a loop over any byte:
+	  CAT
+	  / \
+	 /   \
+	*   TREE
+	|
+      [\0-\377]
+   so that a search anchored at the end of the text, where the reversed
+   text starts, finds the starts of the matches anywhere before it.  */
+
+static bin_tree_t *
+parse_reverse_prefix (re_dfa_t *dfa, bin_tree_t *tree, reg_errcode_t *err)
+{
+  bin_tree_t *any, *star, *root;
+  re_token_t br_token;
+  re_bitset_ptr_t sbcset;
+
+  sbcset = (re_bitset_ptr_t) re_calloc_tag (sizeof (bitset_t), 1,
+					    REG_MEM_COMPILE);
+  if (__glibc_unlikely (sbcset == NULL))
+    {
+      *err = REG_ESPACE;
+      return NULL;
+    }
+  bitset_set_all (sbcset);
+
+  memset (&br_token, 0, sizeof br_token);
+  br_token.type = SIMPLE_BRACKET;
+  br_token.opr.sbcset = sbcset;
+  any = create_token_tree (dfa, NULL, NULL, &br_token);
+  if (__glibc_unlikely (any == NULL))
+    {
+      re_free (sbcset);
+      *err = REG_ESPACE;
+      return NULL;
+    }
+  star = create_tree (dfa, any, NULL, OP_DUP_ASTERISK);
+  root = star != NULL ? create_tree (dfa, star, tree, CONCAT) : NULL;
+  if (__glibc_unlikely (root == NULL))
+    {
+      *err = REG_ESPACE;
+      return NULL;
+    }
+  return root;
+}
+
 /* This function build the following tree, from regular expression
    <branch1>|<branch2>:
 	   ALT
@@ -2464,7 +3481,11 @@ parse_branch (re_string_t *regexp, regex_t *preg, re_token_t *token,
 	}
       if (tree != NULL && expr != NULL)
 	{
-	  bin_tree_t *newtree = create_tree (dfa, tree, expr, CONCAT);
+	  /* The reversed pattern matches the reversed text: a branch
+	     reads its expressions from the last one.  */
+	  bin_tree_t *newtree = (dfa->reversed
+				 ? create_tree (dfa, expr, tree, CONCAT)
+				 : create_tree (dfa, tree, expr, CONCAT));
 	  if (newtree == NULL)
 	    {
 	      postorder (expr, free_tree, NULL);
@@ -2634,6 +3655,33 @@ parse_expression (re_string_t *regexp, regex_t *preg, re_token_t *token,
 	}
       else
 	{
+	  /* In the reversed text the preceding byte follows and the
+	     following one precedes: the start of a line, of the buffer
+	     or of a word is its end.  The others are symmetric.  */
+	  if (dfa->reversed)
+	    switch (token->opr.ctx_type)
+	      {
+	      case LINE_FIRST:
+		token->opr.ctx_type = LINE_LAST;
+		break;
+	      case LINE_LAST:
+		token->opr.ctx_type = LINE_FIRST;
+		break;
+	      case BUF_FIRST:
+		token->opr.ctx_type = BUF_LAST;
+		break;
+	      case BUF_LAST:
+		token->opr.ctx_type = BUF_FIRST;
+		break;
+	      case WORD_FIRST:
+		token->opr.ctx_type = WORD_LAST;
+		break;
+	      case WORD_LAST:
+		token->opr.ctx_type = WORD_FIRST;
+		break;
+	      default:
+		break;
+	      }
 	  tree = create_token_tree (dfa, NULL, NULL, token);
 	  if (__glibc_unlikely (tree == NULL))
 	    {
@@ -3061,10 +4109,10 @@ build_range_exp (const reg_syntax_t syntax,
 	    new_nranges = 2 * mbcset->nranges + 1;
 	    /* Use realloc since mbcset->range_starts and mbcset->range_ends
 	       are NULL if *range_alloc == 0.  */
-	    new_array_start = re_realloc (mbcset->range_starts, wchar_t,
-					  new_nranges);
-	    new_array_end = re_realloc (mbcset->range_ends, wchar_t,
-					new_nranges);
+	    new_array_start = re_realloc_tag (mbcset->range_starts, wchar_t,
+					      new_nranges, REG_MEM_COMPILE);
+	    new_array_end = re_realloc_tag (mbcset->range_ends, wchar_t,
+					    new_nranges, REG_MEM_COMPILE);
 
 	    if (__glibc_unlikely (new_array_start == NULL
 				  || new_array_end == NULL))
@@ -3295,10 +4343,10 @@ parse_bracket_exp (re_string_t *regexp, re_dfa_t *dfa, re_token_t *token,
 
 	      /* +1 in case of mbcset->nranges is 0.  */
 	      new_nranges = 2 * mbcset->nranges + 1;
-	      new_array_start = re_realloc (mbcset->range_starts, uint32_t,
-					    new_nranges);
-	      new_array_end = re_realloc (mbcset->range_ends, uint32_t,
-					  new_nranges);
+	      new_array_start = re_realloc_tag (mbcset->range_starts, uint32_t,
+						new_nranges, REG_MEM_COMPILE);
+	      new_array_end = re_realloc_tag (mbcset->range_ends, uint32_t,
+					      new_nranges, REG_MEM_COMPILE);
 
 	      if (__glibc_unlikely (new_array_start == NULL
 				    || new_array_end == NULL))
@@ -3376,8 +4424,10 @@ parse_bracket_exp (re_string_t *regexp, re_dfa_t *dfa, re_token_t *token,
 	      Idx new_coll_sym_alloc = 2 * mbcset->ncoll_syms + 1;
 	      /* Use realloc since mbcset->coll_syms is NULL
 		 if *alloc == 0.  */
-	      int32_t *new_coll_syms = re_realloc (mbcset->coll_syms, int32_t,
-						   new_coll_sym_alloc);
+	      int32_t *new_coll_syms = re_realloc_tag (mbcset->coll_syms,
+						       int32_t,
+						       new_coll_sym_alloc,
+						       REG_MEM_COMPILE);
 	      if (__glibc_unlikely (new_coll_syms == NULL))
 		return REG_ESPACE;
 	      mbcset->coll_syms = new_coll_syms;
@@ -3427,9 +4477,11 @@ parse_bracket_exp (re_string_t *regexp, re_dfa_t *dfa, re_token_t *token,
 						   _NL_COLLATE_SYMB_EXTRAMB);
     }
 #endif
-  sbcset = (re_bitset_ptr_t) re_calloc (sizeof (bitset_t), 1);
+  sbcset = (re_bitset_ptr_t) re_calloc_tag (sizeof (bitset_t), 1,
+					    REG_MEM_COMPILE);
 #ifdef RE_ENABLE_I18N
-  mbcset = (re_charset_t *) re_calloc (sizeof (re_charset_t), 1);
+  mbcset = (re_charset_t *) re_calloc_tag (sizeof (re_charset_t), 1,
+					   REG_MEM_COMPILE);
 #endif /* RE_ENABLE_I18N */
 #ifdef RE_ENABLE_I18N
   if (__glibc_unlikely (sbcset == NULL || mbcset == NULL))
@@ -3460,7 +4512,7 @@ parse_bracket_exp (re_string_t *regexp, re_dfa_t *dfa, re_token_t *token,
         /* +1 in case of mbcset->nmbchars is 0.  */
         mbchar_alloc = 2 * regexp->len;
         /* Use realloc since array is NULL if *alloc == 0.  */
-        new_mbchars = re_malloc (wchar_t, mbchar_alloc);
+        new_mbchars = re_malloc_tag (wchar_t, mbchar_alloc, REG_MEM_COMPILE);
         if (__glibc_unlikely (new_mbchars == NULL))
             goto parse_bracket_exp_espace;
         mbcset->mbchars = new_mbchars;
@@ -3592,8 +4644,8 @@ parse_bracket_exp (re_string_t *regexp, re_dfa_t *dfa, re_token_t *token,
 		  /* +1 in case of mbcset->nmbchars is 0.  */
 		  mbchar_alloc = 2 * mbcset->nmbchars + 1;
 		  /* Use realloc since array is NULL if *alloc == 0.  */
-		  new_mbchars = re_realloc (mbcset->mbchars, wchar_t,
-					    mbchar_alloc);
+		  new_mbchars = re_realloc_tag (mbcset->mbchars, wchar_t,
+						mbchar_alloc, REG_MEM_COMPILE);
 		  if (__glibc_unlikely (new_mbchars == NULL))
 		    goto parse_bracket_exp_espace;
 		  mbcset->mbchars = new_mbchars;
@@ -3865,9 +4917,10 @@ build_equiv_class (bitset_t sbcset, const unsigned char *name)
 	  /* +1 in case of mbcset->nequiv_classes is 0.  */
 	  Idx new_equiv_class_alloc = 2 * mbcset->nequiv_classes + 1;
 	  /* Use realloc since the array is NULL if *alloc == 0.  */
-	  int32_t *new_equiv_classes = re_realloc (mbcset->equiv_classes,
-						   int32_t,
-						   new_equiv_class_alloc);
+	  int32_t *new_equiv_classes = re_realloc_tag (mbcset->equiv_classes,
+						       int32_t,
+						       new_equiv_class_alloc,
+						       REG_MEM_COMPILE);
 	  if (__glibc_unlikely (new_equiv_classes == NULL))
 	    return REG_ESPACE;
 	  mbcset->equiv_classes = new_equiv_classes;
@@ -3918,8 +4971,10 @@ build_charclass (RE_TRANSLATE_TYPE trans, bitset_t sbcset,
       /* +1 in case of mbcset->nchar_classes is 0.  */
       Idx new_char_class_alloc = 2 * mbcset->nchar_classes + 1;
       /* Use realloc since array is NULL if *alloc == 0.  */
-      wctype_t *new_char_classes = re_realloc (mbcset->char_classes, wctype_t,
-					       new_char_class_alloc);
+      wctype_t *new_char_classes = re_realloc_tag (mbcset->char_classes,
+						   wctype_t,
+						   new_char_class_alloc,
+						   REG_MEM_COMPILE);
       if (__glibc_unlikely (new_char_classes == NULL))
 	return REG_ESPACE;
       mbcset->char_classes = new_char_classes;
@@ -3989,14 +5044,16 @@ build_charclass_op (re_dfa_t *dfa, RE_TRANSLATE_TYPE trans,
   re_token_t br_token;
   bin_tree_t *tree;
 
-  sbcset = (re_bitset_ptr_t) re_calloc (sizeof (bitset_t), 1);
+  sbcset = (re_bitset_ptr_t) re_calloc_tag (sizeof (bitset_t), 1,
+					    REG_MEM_COMPILE);
   if (__glibc_unlikely (sbcset == NULL))
     {
       *err = REG_ESPACE;
       return NULL;
     }
 #ifdef RE_ENABLE_I18N
-  mbcset = (re_charset_t *) re_calloc (sizeof (re_charset_t), 1);
+  mbcset = (re_charset_t *) re_calloc_tag (sizeof (re_charset_t), 1,
+					   REG_MEM_COMPILE);
   if (__glibc_unlikely (mbcset == NULL))
     {
       re_free (sbcset);
@@ -4147,7 +5204,8 @@ create_token_tree (re_dfa_t *dfa, bin_tree_t *left, bin_tree_t *right,
   bin_tree_t *tree;
   if (__glibc_unlikely (dfa->str_tree_storage_idx == BIN_TREE_STORAGE_SIZE))
     {
-      bin_tree_storage_t *storage = re_malloc (bin_tree_storage_t, 1);
+      bin_tree_storage_t *storage = re_malloc_tag (bin_tree_storage_t, 1,
+						   REG_MEM_COMPILE);
 
       if (storage == NULL)
 	return NULL;
@@ -26,6 +26,10 @@
 // SMR-־Զ-20241227-004 ڴ溯ԭϵͳ
 reg_mem_t g_reg_mem = {0};
 
+#ifdef RE_ENABLE_TRACE
+reg_trace_t g_reg_trace = {0};
+#endif
+
 static void re_string_construct_common (const char *str, Idx len,
 					re_string_t *pstr,
 					RE_TRANSLATE_TYPE trans, bool icase,
@@ -37,6 +41,13 @@ static re_dfastate_t *create_cd_newstate (const re_dfa_t *dfa,
 					  const re_node_set *nodes,
 					  unsigned int context,
 					  re_hashval_t hash);
+static void insert_state (const re_dfa_t *dfa, re_dfastate_t *state);
+static reg_errcode_t grow_state_table (const re_dfa_t *dfa);
+static Idx find_state_slot (const re_dfa_t *dfa, const re_dfastate_t *state);
+static unsigned int calc_halt_contexts (const re_dfa_t *dfa,
+					const re_dfastate_t *state);
+static Idx eager_transition (const re_dfa_t *dfa, const Idx *slot_index,
+			     Idx s, Idx a);
 
 /* Functions for string operation.  */
 
@@ -150,13 +161,15 @@ re_string_realloc_buffers (re_string_t *pstr, Idx new_buf_len)
 			    < (size_t)new_buf_len))
 	return REG_ESPACE;
 
-      new_wcs = re_realloc (pstr->wcs, wint_t, new_buf_len);
+      new_wcs = re_realloc_tag (pstr->wcs, wint_t, new_buf_len,
+				REG_MEM_WCS_BUFFERS);
       if (__glibc_unlikely (new_wcs == NULL))
 	return REG_ESPACE;
       pstr->wcs = new_wcs;
       if (pstr->offsets != NULL)
 	{
-	  Idx *new_offsets = re_realloc (pstr->offsets, Idx, new_buf_len);
+	  Idx *new_offsets = re_realloc_tag (pstr->offsets, Idx, new_buf_len,
+					     REG_MEM_WCS_BUFFERS);
 	  if (__glibc_unlikely (new_offsets == NULL))
 	    return REG_ESPACE;
 	  pstr->offsets = new_offsets;
@@ -165,8 +178,9 @@ re_string_realloc_buffers (re_string_t *pstr, Idx new_buf_len)
 #endif /* RE_ENABLE_I18N  */
   if (pstr->mbs_allocated)
     {
-      unsigned char *new_mbs = re_realloc (pstr->mbs, unsigned char,
-					   new_buf_len);
+      unsigned char *new_mbs = re_realloc_tag (pstr->mbs, unsigned char,
+					       new_buf_len,
+					       REG_MEM_WCS_BUFFERS);
       if (__glibc_unlikely (new_mbs == NULL))
 	return REG_ESPACE;
       pstr->mbs = new_mbs;
@@ -410,7 +424,8 @@ build_wcs_upper_buffer (re_string_t *pstr)
 
 		    if (pstr->offsets == NULL)
 		      {
-			pstr->offsets = re_malloc (Idx, pstr->bufs_len);
+			pstr->offsets = re_malloc_tag (Idx, pstr->bufs_len,
+						       REG_MEM_WCS_BUFFERS);
 
 			if (pstr->offsets == NULL)
 			  return REG_ESPACE;
@@ -579,6 +594,7 @@ re_string_reconstruct (re_string_t *pstr, Idx idx, int eflags)
 {
   Idx offset;
 
+  re_trace (RECONSTRUCT, idx, pstr->raw_mbs_idx);
   if (__glibc_unlikely (pstr->raw_mbs_idx <= idx))
     offset = idx - pstr->raw_mbs_idx;
   else
@@ -968,15 +984,47 @@ re_string_context_at (const re_string_t *input, Idx idx, int eflags)
 
 /* Functions for set operation.  */
 
+/* Make room in SET for NEW_ALLOC elements, more than it has room for,
+   moving them to the heap once they no longer fit in SET itself.  */
+
+static reg_errcode_t
+__attribute_warn_unused_result__
+re_node_set_realloc (re_node_set *set, Idx new_alloc)
+{
+  Idx *new_elems;
+
+  if (new_alloc > RE_NODE_SET_INLINE)
+    {
+      if (set->alloc <= RE_NODE_SET_INLINE)
+	{
+	  new_elems = re_malloc_tag (Idx, new_alloc, REG_MEM_NODE_SETS);
+	  if (__glibc_unlikely (new_elems == NULL))
+	    return REG_ESPACE;
+	  memcpy (new_elems, set->u.inline_elems, set->nelem * sizeof (Idx));
+	}
+      else
+	{
+	  new_elems = re_realloc_tag (set->u.elems, Idx, new_alloc,
+				      REG_MEM_NODE_SETS);
+	  if (__glibc_unlikely (new_elems == NULL))
+	    return REG_ESPACE;
+	}
+      set->u.elems = new_elems;
+    }
+  set->alloc = new_alloc;
+  return REG_NOERROR;
+}
+
 reg_errcode_t
 __attribute_warn_unused_result__
 re_node_set_alloc (re_node_set *set, Idx size)
 {
   set->alloc = size;
   set->nelem = 0;
-  set->elems = re_malloc (Idx, size);
-  if (__glibc_unlikely (set->elems == NULL)
-      && (MALLOC_0_IS_NONNULL || size != 0))
+  if (size <= RE_NODE_SET_INLINE)
+    return REG_NOERROR;
+  set->u.elems = re_malloc_tag (Idx, size, REG_MEM_NODE_SETS);
+  if (__glibc_unlikely (set->u.elems == NULL))
     return REG_ESPACE;
   return REG_NOERROR;
 }
@@ -987,13 +1035,7 @@ re_node_set_init_1 (re_node_set *set, Idx elem)
 {
   set->alloc = 1;
   set->nelem = 1;
-  set->elems = re_malloc (Idx, 1);
-  if (__glibc_unlikely (set->elems == NULL))
-    {
-      set->alloc = set->nelem = 0;
-      return REG_ESPACE;
-    }
-  set->elems[0] = elem;
+  set->u.inline_elems[0] = elem;
   return REG_NOERROR;
 }
 
@@ -1002,26 +1044,23 @@ __attribute_warn_unused_result__
 re_node_set_init_2 (re_node_set *set, Idx elem1, Idx elem2)
 {
   set->alloc = 2;
-  set->elems = re_malloc (Idx, 2);
-  if (__glibc_unlikely (set->elems == NULL))
-    return REG_ESPACE;
   if (elem1 == elem2)
     {
       set->nelem = 1;
-      set->elems[0] = elem1;
+      set->u.inline_elems[0] = elem1;
     }
   else
     {
       set->nelem = 2;
       if (elem1 < elem2)
 	{
-	  set->elems[0] = elem1;
-	  set->elems[1] = elem2;
+	  set->u.inline_elems[0] = elem1;
+	  set->u.inline_elems[1] = elem2;
 	}
       else
 	{
-	  set->elems[0] = elem2;
-	  set->elems[1] = elem1;
+	  set->u.inline_elems[0] = elem2;
+	  set->u.inline_elems[1] = elem1;
 	}
     }
   return REG_NOERROR;
@@ -1031,17 +1070,17 @@ reg_errcode_t
 __attribute_warn_unused_result__
 re_node_set_init_copy (re_node_set *dest, const re_node_set *src)
 {
-  dest->nelem = src->nelem;
   if (src->nelem > 0)
     {
-      dest->alloc = dest->nelem;
-      dest->elems = re_malloc (Idx, dest->alloc);
-      if (__glibc_unlikely (dest->elems == NULL))
+      reg_errcode_t err = re_node_set_alloc (dest, src->nelem);
+      if (__glibc_unlikely (err != REG_NOERROR))
 	{
-	  dest->alloc = dest->nelem = 0;
-	  return REG_ESPACE;
+	  dest->alloc = 0;
+	  return err;
 	}
-      memcpy (dest->elems, src->elems, src->nelem * sizeof (Idx));
+      dest->nelem = src->nelem;
+      memcpy (re_node_set_elems (dest), re_node_set_elems (src),
+	      src->nelem * sizeof (Idx));
     }
   else
     re_node_set_init_empty (dest);
@@ -1049,8 +1088,7 @@ re_node_set_init_copy (re_node_set *dest, const re_node_set *src)
 }
 
 /* Calculate the intersection of the sets SRC1 and SRC2. And merge it to
-   DEST. Return value indicate the error code or REG_NOERROR if succeeded.
-   Note: We assume dest->elems is NULL, when dest->alloc is 0.  */
+   DEST. Return value indicate the error code or REG_NOERROR if succeeded.  */
 
 reg_errcode_t
 __attribute_warn_unused_result__
@@ -1058,6 +1096,8 @@ re_node_set_add_intersect (re_node_set *dest, const re_node_set *src1,
 			   const re_node_set *src2)
 {
   Idx i1, i2, is, id, delta, sbase;
+  const Idx *elems1, *elems2;
+  Idx *delems;
   if (src1->nelem == 0 || src2->nelem == 0)
     return REG_NOERROR;
 
@@ -1066,12 +1106,13 @@ re_node_set_add_intersect (re_node_set *dest, const re_node_set *src1,
   if (src1->nelem + src2->nelem + dest->nelem > dest->alloc)
     {
       Idx new_alloc = src1->nelem + src2->nelem + dest->alloc;
-      Idx *new_elems = re_realloc (dest->elems, Idx, new_alloc);
-      if (__glibc_unlikely (new_elems == NULL))
+      if (__glibc_unlikely (re_node_set_realloc (dest, new_alloc)
+			    != REG_NOERROR))
 	return REG_ESPACE;
-      dest->elems = new_elems;
-      dest->alloc = new_alloc;
     }
+  elems1 = re_node_set_elems (src1);
+  elems2 = re_node_set_elems (src2);
+  delems = re_node_set_elems (dest);
 
   /* Find the items in the intersection of SRC1 and SRC2, and copy
      into the top of DEST those that are not already in DEST itself.  */
@@ -1081,21 +1122,21 @@ re_node_set_add_intersect (re_node_set *dest, const re_node_set *src1,
   id = dest->nelem - 1;
   for (;;)
     {
-      if (src1->elems[i1] == src2->elems[i2])
+      if (elems1[i1] == elems2[i2])
 	{
 	  /* Try to find the item in DEST.  Maybe we could binary search?  */
-	  while (id >= 0 && dest->elems[id] > src1->elems[i1])
+	  while (id >= 0 && delems[id] > elems1[i1])
 	    --id;
 
-	  if (id < 0 || dest->elems[id] != src1->elems[i1])
-            dest->elems[--sbase] = src1->elems[i1];
+	  if (id < 0 || delems[id] != elems1[i1])
+            delems[--sbase] = elems1[i1];
 
 	  if (--i1 < 0 || --i2 < 0)
 	    break;
 	}
 
       /* Lower the highest of the two items.  */
-      else if (src1->elems[i1] < src2->elems[i2])
+      else if (elems1[i1] < elems2[i2])
 	{
 	  if (--i2 < 0)
 	    break;
@@ -1118,24 +1159,24 @@ re_node_set_add_intersect (re_node_set *dest, const re_node_set *src1,
   if (delta > 0 && id >= 0)
     for (;;)
       {
-	if (dest->elems[is] > dest->elems[id])
+	if (delems[is] > delems[id])
 	  {
 	    /* Copy from the top.  */
-	    dest->elems[id + delta--] = dest->elems[is--];
+	    delems[id + delta--] = delems[is--];
 	    if (delta == 0)
 	      break;
 	  }
 	else
 	  {
 	    /* Slide from the bottom.  */
-	    dest->elems[id + delta] = dest->elems[id];
+	    delems[id + delta] = delems[id];
 	    if (--id < 0)
 	      break;
 	  }
       }
 
   /* Copy remaining SRC elements.  */
-  memcpy (dest->elems, dest->elems + sbase, delta * sizeof (Idx));
+  memcpy (delems, delems + sbase, delta * sizeof (Idx));
 
   return REG_NOERROR;
 }
@@ -1149,11 +1190,13 @@ re_node_set_init_union (re_node_set *dest, const re_node_set *src1,
 			const re_node_set *src2)
 {
   Idx i1, i2, id;
+  const Idx *elems1, *elems2;
+  Idx *delems;
   if (src1 != NULL && src1->nelem > 0 && src2 != NULL && src2->nelem > 0)
     {
-      dest->alloc = src1->nelem + src2->nelem;
-      dest->elems = re_malloc (Idx, dest->alloc);
-      if (__glibc_unlikely (dest->elems == NULL))
+      if (__glibc_unlikely (re_node_set_alloc (dest,
+					       src1->nelem + src2->nelem)
+			    != REG_NOERROR))
 	return REG_ESPACE;
     }
   else
@@ -1166,26 +1209,29 @@ re_node_set_init_union (re_node_set *dest, const re_node_set *src1,
 	re_node_set_init_empty (dest);
       return REG_NOERROR;
     }
+  elems1 = re_node_set_elems (src1);
+  elems2 = re_node_set_elems (src2);
+  delems = re_node_set_elems (dest);
   for (i1 = i2 = id = 0 ; i1 < src1->nelem && i2 < src2->nelem ;)
     {
-      if (src1->elems[i1] > src2->elems[i2])
+      if (elems1[i1] > elems2[i2])
 	{
-	  dest->elems[id++] = src2->elems[i2++];
+	  delems[id++] = elems2[i2++];
 	  continue;
 	}
-      if (src1->elems[i1] == src2->elems[i2])
+      if (elems1[i1] == elems2[i2])
 	++i2;
-      dest->elems[id++] = src1->elems[i1++];
+      delems[id++] = elems1[i1++];
     }
   if (i1 < src1->nelem)
     {
-      memcpy (dest->elems + id, src1->elems + i1,
+      memcpy (delems + id, elems1 + i1,
 	     (src1->nelem - i1) * sizeof (Idx));
       id += src1->nelem - i1;
     }
   else if (i2 < src2->nelem)
     {
-      memcpy (dest->elems + id, src2->elems + i2,
+      memcpy (delems + id, elems2 + i2,
 	     (src2->nelem - i2) * sizeof (Idx));
       id += src2->nelem - i2;
     }
@@ -1201,22 +1247,24 @@ __attribute_warn_unused_result__
 re_node_set_merge (re_node_set *dest, const re_node_set *src)
 {
   Idx is, id, sbase, delta;
+  const Idx *selems;
+  Idx *delems;
   if (src == NULL || src->nelem == 0)
     return REG_NOERROR;
     if (dest->alloc < /*2*/4 * src->nelem + dest->nelem)
     {
       Idx new_alloc = /*2*/4 * (src->nelem + dest->alloc);
-      Idx *new_buffer = re_realloc (dest->elems, Idx, new_alloc);
-      if (__glibc_unlikely (new_buffer == NULL))
+      if (__glibc_unlikely (re_node_set_realloc (dest, new_alloc)
+			    != REG_NOERROR))
 	return REG_ESPACE;
-      dest->elems = new_buffer;
-      dest->alloc = new_alloc;
     }
+  selems = re_node_set_elems (src);
+  delems = re_node_set_elems (dest);
 
   if (__glibc_unlikely (dest->nelem == 0))
     {
       dest->nelem = src->nelem;
-      memcpy (dest->elems, src->elems, src->nelem * sizeof (Idx));
+      memcpy (delems, selems, src->nelem * sizeof (Idx));
       return REG_NOERROR;
     }
 
@@ -1225,11 +1273,11 @@ re_node_set_merge (re_node_set *dest, const re_node_set *src)
   for (sbase = dest->nelem + 2 * src->nelem,
        is = src->nelem - 1, id = dest->nelem - 1; is >= 0 && id >= 0; )
     {
-      if (dest->elems[id] == src->elems[is])
+      if (delems[id] == selems[is])
 	is--, id--;
-      else if (dest->elems[id] < src->elems[is])
-	dest->elems[--sbase] = src->elems[is--];
-      else /* if (dest->elems[id] > src->elems[is]) */
+      else if (delems[id] < selems[is])
+	delems[--sbase] = selems[is--];
+      else /* if (delems[id] > selems[is]) */
 	--id;
     }
 
@@ -1237,7 +1285,7 @@ re_node_set_merge (re_node_set *dest, const re_node_set *src)
     {
       /* If DEST is exhausted, the remaining items of SRC must be unique.  */
       sbase -= is + 1;
-      memcpy (dest->elems + sbase, src->elems, (is + 1) * sizeof (Idx));
+      memcpy (delems + sbase, selems, (is + 1) * sizeof (Idx));
     }
 
   id = dest->nelem - 1;
@@ -1251,21 +1299,21 @@ re_node_set_merge (re_node_set *dest, const re_node_set *src)
   dest->nelem += delta;
   for (;;)
     {
-      if (dest->elems[is] > dest->elems[id])
+      if (delems[is] > delems[id])
 	{
 	  /* Copy from the top.  */
-	  dest->elems[id + delta--] = dest->elems[is--];
+	  delems[id + delta--] = delems[is--];
 	  if (delta == 0)
 	    break;
 	}
       else
 	{
 	  /* Slide from the bottom.  */
-	  dest->elems[id + delta] = dest->elems[id];
+	  delems[id + delta] = delems[id];
 	  if (--id < 0)
 	    {
 	      /* Copy remaining SRC elements.  */
-	      memcpy (dest->elems, dest->elems + sbase,
+	      memcpy (delems, delems + sbase,
 		      delta * sizeof (Idx));
 	      break;
 	    }
@@ -1284,6 +1332,7 @@ __attribute_warn_unused_result__
 re_node_set_insert (re_node_set *set, Idx elem)
 {
   Idx idx;
+  Idx *elems;
   /* In case the set is empty.  */
   if (set->alloc == 0)
     return __glibc_likely (re_node_set_init_1 (set, elem) == REG_NOERROR);
@@ -1291,38 +1340,34 @@ re_node_set_insert (re_node_set *set, Idx elem)
   if (__glibc_unlikely (set->nelem) == 0)
     {
       /* We already guaranteed above that set->alloc != 0.  */
-      set->elems[0] = elem;
+      re_node_set_elems (set)[0] = elem;
       ++set->nelem;
       return true;
     }
 
   /* Realloc if we need.  */
-  if (set->alloc == set->nelem)
-    {
-      Idx *new_elems;
-      set->alloc = set->alloc * 2;
-      new_elems = re_realloc (set->elems, Idx, set->alloc);
-      if (__glibc_unlikely (new_elems == NULL))
-	return false;
-      set->elems = new_elems;
-    }
+  if (set->alloc == set->nelem
+      && __glibc_unlikely (re_node_set_realloc (set, set->alloc * 2)
+			   != REG_NOERROR))
+    return false;
+  elems = re_node_set_elems (set);
 
   /* Move the elements which follows the new element.  Test the
      first element separately to skip a check in the inner loop.  */
-  if (elem < set->elems[0])
+  if (elem < elems[0])
     {
       idx = 0;
       for (idx = set->nelem; idx > 0; idx--)
-	set->elems[idx] = set->elems[idx - 1];
+	elems[idx] = elems[idx - 1];
     }
   else
     {
-      for (idx = set->nelem; set->elems[idx - 1] > elem; idx--)
-	set->elems[idx] = set->elems[idx - 1];
+      for (idx = set->nelem; elems[idx - 1] > elem; idx--)
+	elems[idx] = elems[idx - 1];
     }
 
   /* Insert the new element.  */
-  set->elems[idx] = elem;
+  elems[idx] = elem;
   ++set->nelem;
   return true;
 }
@@ -1336,18 +1381,13 @@ __attribute_warn_unused_result__
 re_node_set_insert_last (re_node_set *set, Idx elem)
 {
   /* Realloc if we need.  */
-  if (set->alloc == set->nelem)
-    {
-      Idx *new_elems;
-      set->alloc = (set->alloc + 1) * 2;
-      new_elems = re_realloc (set->elems, Idx, set->alloc);
-      if (__glibc_unlikely (new_elems == NULL))
-	return false;
-      set->elems = new_elems;
-    }
+  if (set->alloc == set->nelem
+      && __glibc_unlikely (re_node_set_realloc (set, (set->alloc + 1) * 2)
+			   != REG_NOERROR))
+    return false;
 
   /* Insert the new element.  */
-  set->elems[set->nelem++] = elem;
+  re_node_set_elems (set)[set->nelem++] = elem;
   return true;
 }
 
@@ -1359,10 +1399,13 @@ __attribute__ ((pure))
 re_node_set_compare (const re_node_set *set1, const re_node_set *set2)
 {
   Idx i;
+  const Idx *elems1, *elems2;
   if (set1 == NULL || set2 == NULL || set1->nelem != set2->nelem)
     return false;
+  elems1 = re_node_set_elems (set1);
+  elems2 = re_node_set_elems (set2);
   for (i = set1->nelem ; --i >= 0 ; )
-    if (set1->elems[i] != set2->elems[i])
+    if (elems1[i] != elems2[i])
       return false;
   return true;
 }
@@ -1374,31 +1417,121 @@ __attribute__ ((pure))
 re_node_set_contains (const re_node_set *set, Idx elem)
 {
   __re_size_t idx, right, mid;
+  const Idx *elems;
   if (set->nelem <= 0)
     return 0;
 
   /* Binary search the element.  */
+  elems = re_node_set_elems (set);
   idx = 0;
   right = set->nelem - 1;
   while (idx < right)
     {
       mid = (idx + right) / 2;
-      if (set->elems[mid] < elem)
+      if (elems[mid] < elem)
 	idx = mid + 1;
       else
 	right = mid;
     }
-  return set->elems[idx] == elem ? idx + 1 : 0;
+  return elems[idx] == elem ? idx + 1 : 0;
 }
 
 void
 re_node_set_remove_at (re_node_set *set, Idx idx)
 {
+  Idx *elems = re_node_set_elems (set);
   if (idx < 0 || idx >= set->nelem)
     return;
   --set->nelem;
   for (; idx < set->nelem; idx++)
-    set->elems[idx] = set->elems[idx + 1];
+    elems[idx] = elems[idx + 1];
+}
+
+/* Functions for node bitsets.  A re_node_bitset takes the union of any
+   number of node sets in time linear in their sizes, where merging
+   them one at a time with re_node_set_merge is quadratic; build_trtable
+   uses it for DFAs of up to RE_NODE_BITSET_MAX nodes.  */
+
+/* Clear BITS for the nodes of a DFA with NODES_LEN nodes, at most
+   RE_NODE_BITSET_MAX.  */
+
+void
+re_node_bitset_init (re_node_bitset *bits, Idx nodes_len)
+{
+  memset (bits->words, '\0',
+	  ((nodes_len + BITSET_WORD_BITS - 1) / BITSET_WORD_BITS
+	   * sizeof (bitset_word_t)));
+  bits->lo = RE_NODE_BITSET_WORDS;
+  bits->hi = -1;
+  bits->nadded = 0;
+}
+
+/* Add the nodes in SET to BITS.  */
+
+void
+re_node_bitset_add (re_node_bitset *bits, const re_node_set *set)
+{
+  const Idx *elems = re_node_set_elems (set);
+  Idx i, lo, hi;
+  if (set->nelem <= 0)
+    return;
+  for (i = 0; i < set->nelem; ++i)
+    {
+      __re_size_t node = elems[i];
+      bits->words[node / BITSET_WORD_BITS]
+	|= (bitset_word_t) 1 << node % BITSET_WORD_BITS;
+    }
+  lo = elems[0] / BITSET_WORD_BITS;
+  hi = elems[set->nelem - 1] / BITSET_WORD_BITS;
+  if (lo < bits->lo)
+    bits->lo = lo;
+  if (hi > bits->hi)
+    bits->hi = hi;
+  bits->nadded += set->nelem;
+}
+
+/* Store the nodes in BITS to DEST in ascending order, replacing what
+   DEST held, and clear BITS for the next union.  Return value indicate
+   the error code or REG_NOERROR if succeeded.  */
+
+reg_errcode_t
+__attribute_warn_unused_result__
+re_node_bitset_take (re_node_bitset *bits, re_node_set *dest)
+{
+  Idx w, bit, nelem = 0;
+  Idx size = (bits->hi - bits->lo + 1) * BITSET_WORD_BITS;
+  Idx *elems;
+  bitset_word_t word;
+
+  /* Sets that overlap much add far more nodes than their union has.  */
+  if (size > bits->nadded)
+    size = bits->nadded;
+  dest->nelem = 0;
+  if (dest->alloc < size
+      && __glibc_unlikely (re_node_set_realloc (dest, size) != REG_NOERROR))
+    return REG_ESPACE;
+  elems = re_node_set_elems (dest);
+  for (w = bits->lo; w <= bits->hi; ++w)
+    {
+      word = bits->words[w];
+      bits->words[w] = 0;
+      /* Visit the set bits only: most words of a sparse union have few.  */
+      for (; word; word &= word - 1)
+	{
+#ifdef __GNUC__
+	  bit = __builtin_ctzl (word);
+#else
+	  for (bit = 0; !(word >> bit & 1); ++bit)
+	    ;
+#endif
+	  elems[nelem++] = w * BITSET_WORD_BITS + bit;
+	}
+    }
+  dest->nelem = nelem;
+  bits->lo = RE_NODE_BITSET_WORDS;
+  bits->hi = -1;
+  bits->nadded = 0;
+  return REG_NOERROR;
 }
 
 
@@ -1423,14 +1556,19 @@ re_dfa_add_node (re_dfa_t *dfa, re_token_t token)
 			    < new_nodes_alloc))
 	return -1;
 
-      new_nodes = re_realloc (dfa->nodes, re_token_t, new_nodes_alloc);
+      new_nodes = re_realloc_tag (dfa->nodes, re_token_t, new_nodes_alloc,
+				  REG_MEM_COMPILE);
       if (__glibc_unlikely (new_nodes == NULL))
 	return -1;
       dfa->nodes = new_nodes;
-      new_nexts = re_realloc (dfa->nexts, Idx, new_nodes_alloc);
-      new_indices = re_realloc (dfa->org_indices, Idx, new_nodes_alloc);
-      new_edests = re_realloc (dfa->edests, re_node_set, new_nodes_alloc);
-      new_eclosures = re_realloc (dfa->eclosures, re_node_set, new_nodes_alloc);
+      new_nexts = re_realloc_tag (dfa->nexts, Idx, new_nodes_alloc,
+				  REG_MEM_COMPILE);
+      new_indices = re_realloc_tag (dfa->org_indices, Idx, new_nodes_alloc,
+				    REG_MEM_COMPILE);
+      new_edests = re_realloc_tag (dfa->edests, re_node_set, new_nodes_alloc,
+				   REG_MEM_COMPILE);
+      new_eclosures = re_realloc_tag (dfa->eclosures, re_node_set,
+				      new_nodes_alloc, REG_MEM_COMPILE);
       if (__glibc_unlikely (new_nexts == NULL || new_indices == NULL
 			    || new_edests == NULL || new_eclosures == NULL))
 	{
@@ -1459,13 +1597,29 @@ re_dfa_add_node (re_dfa_t *dfa, re_token_t token)
   return (Idx)(dfa->nodes_len++);
 }
 
+/* Hash NODES and CONTEXT.  Besides the sum of the elements, the sum of
+   the running sums weighs every element by its position, so that sets
+   with the same sum seldom collide; both take one addition per element.
+   The result is mixed at the end, since the state table uses its low
+   bits.  */
+
 static re_hashval_t
 calc_state_hash (const re_node_set *nodes, unsigned int context)
 {
-  re_hashval_t hash = nodes->nelem + context;
+  re_hashval_t sum = nodes->nelem + context, hash = context;
+  const Idx *elems = re_node_set_elems (nodes);
   Idx i;
   for (i = 0 ; i < nodes->nelem ; i++)
-    hash += nodes->elems[i];
+    {
+      sum += elems[i];
+      hash += sum;
+    }
+  hash = hash * 0x9e3779b9u + sum;
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
   return hash;
 }
 
@@ -1483,10 +1637,9 @@ __attribute_warn_unused_result__
 re_acquire_state (reg_errcode_t *err, const re_dfa_t *dfa,
 		  const re_node_set *nodes)
 {
-  re_hashval_t hash;
+  re_hashval_t hash, i;
   re_dfastate_t *new_state;
-  struct re_state_table_entry *spot;
-  Idx i;
+  const struct re_state_table_entry *spot;
 //#if defined GCC_LINT || defined lint
   /* Suppress bogus uninitialized-variable warnings.  */
   *err = REG_NOERROR;
@@ -1497,15 +1650,15 @@ re_acquire_state (reg_errcode_t *err, const re_dfa_t *dfa,
       return NULL;
     }
   hash = calc_state_hash (nodes, 0);
-  spot = dfa->state_table + (hash & dfa->state_hash_mask);
 
-  for (i = 0 ; i < spot->num ; i++)
+  for (i = hash & dfa->state_hash_mask; ; i = (i + 1) & dfa->state_hash_mask)
     {
-      re_dfastate_t *state = spot->array[i];
-      if (hash != state->hash)
-	continue;
-      if (re_node_set_compare (&state->nodes, nodes))
-	return state;
+      spot = dfa->state_table + i;
+      if (spot->state == NULL)
+	break;
+      if (spot->hash == hash
+	  && re_node_set_compare (&spot->state->nodes, nodes))
+	return spot->state;
     }
 
   /* There are no appropriate state in the dfa, create the new one.  */
@@ -1531,10 +1684,9 @@ __attribute_warn_unused_result__
 re_acquire_state_context (reg_errcode_t *err, const re_dfa_t *dfa,
 			  const re_node_set *nodes, unsigned int context)
 {
-  re_hashval_t hash;
+  re_hashval_t hash, i;
   re_dfastate_t *new_state;
-  struct re_state_table_entry *spot;
-  Idx i;
+  const struct re_state_table_entry *spot;
 //#if defined GCC_LINT || defined lint
   /* Suppress bogus uninitialized-variable warnings.  */
   *err = REG_NOERROR;
@@ -1545,15 +1697,16 @@ re_acquire_state_context (reg_errcode_t *err, const re_dfa_t *dfa,
       return NULL;
     }
   hash = calc_state_hash (nodes, context);
-  spot = dfa->state_table + (hash & dfa->state_hash_mask);
 
-  for (i = 0 ; i < spot->num ; i++)
+  for (i = hash & dfa->state_hash_mask; ; i = (i + 1) & dfa->state_hash_mask)
     {
-      re_dfastate_t *state = spot->array[i];
-      if (state->hash == hash
-	  && state->context == context
-	  && re_node_set_compare (state->entrance_nodes, nodes))
-	return state;
+      spot = dfa->state_table + i;
+      if (spot->state == NULL)
+	break;
+      if (spot->hash == hash
+	  && spot->state->context == context
+	  && re_node_set_compare (spot->state->entrance_nodes, nodes))
+	return spot->state;
     }
   /* There are no appropriate state in 'dfa', create the new one.  */
   new_state = create_cd_newstate (dfa, nodes, context, hash);
@@ -1572,17 +1725,20 @@ __attribute_warn_unused_result__
 register_state (const re_dfa_t *dfa, re_dfastate_t *newstate,
 		re_hashval_t hash)
 {
-  struct re_state_table_entry *spot;
   reg_errcode_t err;
   Idx i;
 
+  err = re_dfa_check_limit (dfa, 1, 0);
+  if (__glibc_unlikely (err != REG_NOERROR))
+    return err;
+
   newstate->hash = hash;
   err = re_node_set_alloc (&newstate->non_eps_nodes, newstate->nodes.nelem);
   if (__glibc_unlikely (err != REG_NOERROR))
     return REG_ESPACE;
   for (i = 0; i < newstate->nodes.nelem; i++)
     {
-      Idx elem = newstate->nodes.elems[i];
+      Idx elem = re_node_set_elems (&newstate->nodes)[i];
       if (!IS_EPSILON_NODE (dfa->nodes[elem].type))
         {
 	if (! re_node_set_insert_last (&newstate->non_eps_nodes, elem))
@@ -1590,21 +1746,681 @@ register_state (const re_dfa_t *dfa, re_dfastate_t *newstate,
         }
     }
 
-  spot = dfa->state_table + (hash & dfa->state_hash_mask);
-  if (__glibc_unlikely (spot->alloc <= spot->num))
+  /* Keep the table at most half full, so that probe sequences stay
+     short.  */
+  if (__glibc_unlikely ((dfa->nstates + 1) * 2 > dfa->state_hash_mask + 1))
     {
-      Idx new_alloc = 2 * spot->num + 2;
-      re_dfastate_t **new_array = re_realloc (spot->array, re_dfastate_t *,
-					      new_alloc);
-      if (__glibc_unlikely (new_array == NULL))
-	return REG_ESPACE;
-      spot->array = new_array;
-      spot->alloc = new_alloc;
+      err = grow_state_table (dfa);
+      if (__glibc_unlikely (err != REG_NOERROR))
+	return err;
+    }
+  insert_state (dfa, newstate);
+  re_dfa_add_size (dfa, 1, 0);
+  ((re_dfa_t *) dfa)->state_bytes += calc_state_size (newstate);
+  return REG_NOERROR;
+}
+
+/* Put STATE in the first free slot of its probe sequence in the state
+   table of DFA, which must have one.  */
+
+static void
+insert_state (const re_dfa_t *dfa, re_dfastate_t *state)
+{
+  re_hashval_t i;
+
+  for (i = state->hash & dfa->state_hash_mask;
+       dfa->state_table[i].state != NULL;
+       i = (i + 1) & dfa->state_hash_mask)
+    ;
+  dfa->state_table[i].hash = state->hash;
+  dfa->state_table[i].state = state;
+}
+
+/* Double the size of the state table of DFA.  */
+
+static reg_errcode_t
+__attribute_warn_unused_result__
+grow_state_table (const re_dfa_t *dfa)
+{
+  re_dfa_t *mdfa = (re_dfa_t *) dfa;
+  struct re_state_table_entry *old_table = dfa->state_table;
+  re_hashval_t old_size = dfa->state_hash_mask + 1, i;
+  struct re_state_table_entry *new_table;
+
+  /* The doubled table is masked by a re_hashval_t and walked with an
+     Idx.  */
+  if (__glibc_unlikely (old_size > (re_hashval_t) -1 / 2
+			|| (MIN (IDX_MAX, SIZE_MAX / sizeof (*new_table)) / 2
+			    < (size_t) old_size)))
+    return REG_ESPACE;
+  new_table = re_calloc_tag (sizeof (*new_table), 2 * old_size,
+			     REG_MEM_DFA_STATES);
+  if (__glibc_unlikely (new_table == NULL))
+    return REG_ESPACE;
+  mdfa->state_table = new_table;
+  mdfa->state_hash_mask = 2 * old_size - 1;
+  for (i = 0; i < old_size; ++i)
+    if (old_table[i].state != NULL)
+      insert_state (dfa, old_table[i].state);
+  re_free (old_table);
+  return REG_NOERROR;
+}
+
+/* Return the bytes STATE holds, not counting its transition tables.  */
+
+size_t
+calc_state_size (const re_dfastate_t *state)
+{
+  size_t size = (sizeof (re_dfastate_t)
+		 + re_node_set_heap_size (&state->nodes)
+		 + re_node_set_heap_size (&state->non_eps_nodes)
+		 + re_node_set_heap_size (&state->inveclosure));
+  if (state->entrance_nodes != &state->nodes)
+    size += (sizeof (re_node_set)
+	     + re_node_set_heap_size (state->entrance_nodes));
+  return size;
+}
+
+/* Return the bytes of the transition table of STATE, a state of DFA.  */
+
+size_t
+calc_trtable_size (const re_dfa_t *dfa, const re_dfastate_t *state)
+{
+  if (state->eager_trtable != NULL)
+    return ((state->eager_word ? 2 : 1) * dfa->nbyte_classes
+	    * sizeof (re_state_id_t));
+  if (state->trtable != NULL)
+    return dfa->nbyte_classes * sizeof (re_dfastate_t *);
+  if (state->word_trtable != NULL)
+    return 2 * dfa->nbyte_classes * sizeof (re_dfastate_t *);
+  return 0;
+}
+
+/* Check whether DFA may grow by NSTATES states and TRTABLE_BYTES bytes of
+   transition tables without passing the limits set by reg_set_dfa_limit,
+   asking the caller's callback if it would.  */
+
+reg_errcode_t
+re_dfa_check_limit (const re_dfa_t *dfa, Idx nstates, size_t trtable_bytes)
+{
+  size_t new_states = dfa->nstates + nstates;
+  size_t new_bytes = dfa->trtable_bytes + trtable_bytes;
+
+  if (__glibc_likely ((dfa->max_states == 0 || new_states <= dfa->max_states)
+		      && (dfa->max_trtable_bytes == 0
+			  || new_bytes <= dfa->max_trtable_bytes))
+      || dfa->limit_waived)
+    return REG_NOERROR;
+
+  if (dfa->limit_fn == NULL
+      || dfa->limit_fn (new_states, new_bytes, dfa->limit_arg) != 0)
+    return REG_ESPACE;
+  /* The matcher holds the DFA lock; the size and the limit state are the
+     only members of the DFA it updates.  */
+  ((re_dfa_t *) dfa)->limit_waived = 1;
+  return REG_NOERROR;
+}
+
+/* Account for NSTATES new states and TRTABLE_BYTES new bytes of transition
+   tables in the size of DFA.  */
+
+void
+re_dfa_add_size (const re_dfa_t *dfa, Idx nstates, size_t trtable_bytes)
+{
+  re_dfa_t *mdfa = (re_dfa_t *) dfa;
+  mdfa->nstates += nstates;
+  mdfa->trtable_bytes += trtable_bytes;
+}
+
+/* Drop the states cached in DFA, so that the lazy DFA is built again on
+   demand.  The initial states and KEEP, which may be NULL, stay in the
+   state table since the matcher may still refer to them, but their
+   transition tables are freed as they point to the other states.  The
+   states built by re_dfa_materialize stay whole.  */
+
+void
+re_dfa_flush_states (const re_dfa_t *dfa, re_dfastate_t *keep)
+{
+  re_dfa_t *mdfa = (re_dfa_t *) dfa;
+  re_dfastate_t *kept[5];
+  Idx nkept = 0, i, j;
+
+  kept[0] = dfa->init_state;
+  kept[1] = dfa->init_state_word;
+  kept[2] = dfa->init_state_nl;
+  kept[3] = dfa->init_state_begbuf;
+  kept[4] = keep;
+  for (i = 0; i < 5; ++i)
+    {
+      if (kept[i] == NULL)
+	continue;
+      for (j = 0; j < nkept; ++j)
+	if (kept[j] == kept[i])
+	  break;
+      if (j == nkept)
+	kept[nkept++] = kept[i];
+    }
+
+  for (i = 0; i <= (Idx) dfa->state_hash_mask; ++i)
+    {
+      re_dfastate_t *state = dfa->state_table[i].state;
+      if (state == NULL || state->materialized)
+	continue;
+      for (j = 0; j < nkept; ++j)
+	if (kept[j] == state)
+	  break;
+      if (j == nkept)
+	free_state (state);
+    }
+  memset (dfa->state_table, '\0',
+	  (dfa->state_hash_mask + 1) * sizeof (struct re_state_table_entry));
+
+  /* The table is large enough for the states kept, which were in it.
+     The materialized states keep their transition tables, which lead
+     only to each other; searches that do not hold DFA->lock use them.  */
+  mdfa->nstates = 0;
+  mdfa->trtable_bytes = 0;
+  mdfa->state_bytes = 0;
+  for (i = 0; i < nkept; ++i)
+    {
+      re_dfastate_t *state = kept[i];
+      if (state->materialized)
+	continue;
+      re_free (state->trtable);
+      re_free (state->word_trtable);
+      state->trtable = NULL;
+      state->word_trtable = NULL;
+      insert_state (dfa, state);
+      re_dfa_add_size (dfa, 1, 0);
+      mdfa->state_bytes += calc_state_size (state);
+    }
+  for (i = 0; i < dfa->neager_states; ++i)
+    {
+      re_dfastate_t *state = dfa->eager_states[i];
+      insert_state (dfa, state);
+      re_dfa_add_size (dfa, 1, calc_trtable_size (dfa, state));
+      mdfa->state_bytes += calc_state_size (state);
+    }
+  ++mdfa->stats.nflushes;
+}
+
+/* Give SHARD, a copy of a DFA made by reg_dfa_shard, a state table of
+   its own.  It starts with the states built for REG_DFA_EAGER, which
+   never change, so the copies share them; the caller builds the initial
+   states of a lazy DFA.  */
+
+reg_errcode_t
+re_dfa_init_shard (re_dfa_t *shard)
+{
+  __re_size_t table_size;
+  Idx i;
+
+  for (table_size = 1; ; table_size <<= 1)
+    if (table_size > shard->nodes_len
+	&& table_size / 2 > (__re_size_t) shard->neager_states)
+      break;
+  shard->state_table = re_calloc_tag (sizeof (struct re_state_table_entry),
+				      table_size, REG_MEM_DFA_STATES);
+  if (__glibc_unlikely (shard->state_table == NULL))
+    return REG_ESPACE;
+  shard->state_hash_mask = table_size - 1;
+  shard->nstates = 0;
+  shard->trtable_bytes = 0;
+  shard->state_bytes = 0;
+  for (i = 0; i < shard->neager_states; ++i)
+    {
+      re_dfastate_t *state = shard->eager_states[i];
+      insert_state (shard, state);
+      re_dfa_add_size (shard, 1, calc_trtable_size (shard, state));
+      shard->state_bytes += calc_state_size (state);
     }
-  spot->array[spot->num++] = newstate;
   return REG_NOERROR;
 }
 
+/* Return the slot of the state table of DFA that holds STATE.  */
+
+static Idx
+find_state_slot (const re_dfa_t *dfa, const re_dfastate_t *state)
+{
+  re_hashval_t i;
+
+  for (i = state->hash & dfa->state_hash_mask;
+       dfa->state_table[i].state != state;
+       i = (i + 1) & dfa->state_hash_mask)
+    ;
+  return i;
+}
+
+/* Return the contexts in which check_matching accepts STATE as a halt
+   state, as a bit per context value.  */
+
+static unsigned int
+calc_halt_contexts (const re_dfa_t *dfa, const re_dfastate_t *state)
+{
+  unsigned int contexts = 0, context;
+  Idx i;
+
+  if (!state->halt)
+    return 0;
+  for (context = 0; context < (CONTEXT_ENDBUF << 1); ++context)
+    {
+      if (state->has_constraint)
+	{
+	  /* Like check_halt_state_context, which takes the first halt
+	     node that fits and returns node 0 as no match.  */
+	  for (i = 0; i < state->nodes.nelem; ++i)
+	    {
+	      const re_token_t *node
+		= dfa->nodes + re_node_set_elems (&state->nodes)[i];
+	      if (node->type == END_OF_RE
+		  && !NOT_SATISFY_NEXT_CONSTRAINT (node->constraint, context))
+		break;
+	    }
+	  if (i == state->nodes.nelem
+	      || re_node_set_elems (&state->nodes)[i] == 0)
+	    continue;
+	}
+      contexts |= 1u << context;
+    }
+  return contexts;
+}
+
+/* Return the index in DFA->eager_states of the state that the S-th one
+   moves to on symbol A, see re_dfa_minimize, or DFA->neager_states for
+   the dead state.  SLOT_INDEX maps the slots of the state table to the
+   indexes.  */
+
+static Idx
+eager_transition (const re_dfa_t *dfa, const Idx *slot_index, Idx s, Idx a)
+{
+  const re_dfastate_t *state, *dest;
+
+  if (s == dfa->neager_states)
+    return s;
+  state = dfa->eager_states[s];
+  dest = (state->trtable != NULL
+	  ? state->trtable[a % dfa->nbyte_classes]
+	  : state->word_trtable[a]);
+  if (dest == NULL)
+    return dfa->neager_states;
+  return slot_index[find_state_slot (dfa, dest)];
+}
+
+/* Merge the states built by re_dfa_materialize that the matcher cannot
+   tell apart, with Hopcroft's partition refinement.  Two states are
+   equivalent if check_matching accepts them as halt states in the same
+   contexts and their transitions lead to equivalent states for every
+   byte class.  States that cannot reach a halt state are equivalent to
+   the dead state, which transition tables hold as NULL.  The initial
+   states are kept apart, since check_matching compares them with the
+   current state.
+
+   sift_states_backward and set_regs read the nodes of the states in the
+   state log, so the caller makes sure that no search of the pattern
+   keeps one.  The merged states are freed.  Nothing changes if memory
+   runs out.  */
+
+void
+re_dfa_minimize (re_dfa_t *dfa)
+{
+  Idx ns = dfa->neager_states, n = ns + 1, nslots, k, a, b, i, j, s;
+  Idx nblocks = 0, nmask_blocks, nwork = 0, ntouched, sink, nkept;
+  Idx *buf, *slot_index, *inv_start, *inv, *block, *elems, *pos, *bfirst;
+  Idx *bend, *nmarked, *in_work, *work, *splitter, *touched, *rep, *trans;
+  struct re_state_table_entry *old_table, *new_table;
+  re_dfastate_t *init_states[4], **eager_states;
+  bool word = false;
+
+  for (s = 0; s < ns; ++s)
+    if (dfa->eager_states[s]->word_trtable != NULL)
+      word = true;
+  /* The symbols of the automaton are the entries of a transition table,
+     twice as many if some state tells word contexts apart.  The dead
+     state is the sink, index NS.  */
+  k = word ? 2 * dfa->nbyte_classes : dfa->nbyte_classes;
+  nslots = dfa->state_hash_mask + 1;
+  if (__glibc_unlikely ((SIZE_MAX / sizeof (Idx) - nslots - 13 * n - 1)
+			/ 3 / k < (size_t) n))
+    return;
+  buf = re_malloc_tag (Idx, nslots + 3 * n * k + 1 + 13 * n,
+		       REG_MEM_DFA_STATES);
+  new_table = re_calloc_tag (sizeof (*new_table), nslots,
+			     REG_MEM_DFA_STATES);
+  if (__glibc_unlikely (buf == NULL || new_table == NULL))
+    {
+      re_free (buf);
+      re_free (new_table);
+      return;
+    }
+  slot_index = buf;
+  inv_start = slot_index + nslots;
+  inv = inv_start + n * k + 1;
+  block = inv + n * k;
+  elems = block + n;
+  pos = elems + n;
+  bfirst = pos + n;
+  bend = bfirst + n;
+  nmarked = bend + n;
+  in_work = nmarked + n;
+  work = in_work + n;
+  splitter = work + n;
+  touched = splitter + n;
+  rep = touched + n;
+  trans = rep + n;
+
+  for (i = 0; i < nslots; ++i)
+    slot_index[i] = -1;
+  for (s = 0; s < ns; ++s)
+    slot_index[find_state_slot (dfa, dfa->eager_states[s])] = s;
+
+  /* The states moving to state T on symbol A are INV[INV_START[X]] up to
+     INV[INV_START[X + 1]], where X is T * K + A.  TRANS[S * K + A] is the
+     state S moves to on A.  */
+  memset (inv_start, '\0', (n * k + 1) * sizeof (Idx));
+  for (s = 0; s < n; ++s)
+    for (a = 0; a < k; ++a)
+      {
+	Idx t = eager_transition (dfa, slot_index, s, a);
+	trans[s * k + a] = t;
+	++inv_start[t * k + a + 1];
+      }
+  for (i = 0; i < n * k; ++i)
+    inv_start[i + 1] += inv_start[i];
+  for (s = 0; s < n; ++s)
+    for (a = 0; a < k; ++a)
+      inv[inv_start[trans[s * k + a] * k + a]++] = s;
+  for (i = n * k; i > 0; --i)
+    inv_start[i] = inv_start[i - 1];
+  inv_start[0] = 0;
+
+  /* Start with a block per initial state, and a block per set of
+     contexts in which the other states halt; REP holds those sets.  */
+  for (s = 0; s < n; ++s)
+    block[s] = -1;
+  init_states[0] = dfa->init_state;
+  init_states[1] = dfa->init_state_word;
+  init_states[2] = dfa->init_state_nl;
+  init_states[3] = dfa->init_state_begbuf;
+  for (i = 0; i < 4; ++i)
+    {
+      s = slot_index[find_state_slot (dfa, init_states[i])];
+      if (block[s] < 0)
+	block[s] = nblocks++;
+    }
+  nmask_blocks = nblocks;
+  for (s = 0; s < n; ++s)
+    if (block[s] < 0)
+      {
+	Idx contexts = (s < ns
+			? calc_halt_contexts (dfa, dfa->eager_states[s]) : 0);
+	for (b = nmask_blocks; b < nblocks; ++b)
+	  if (rep[b] == contexts)
+	    break;
+	if (b == nblocks)
+	  rep[nblocks++] = contexts;
+	block[s] = b;
+      }
+
+  /* Lay the blocks out in ELEMS, each one from BFIRST to BEND, and put
+     them all in the work list but the largest: splitting by the others
+     splits by it as well.  That one usually holds the sink, which most
+     transitions move to.  */
+  for (b = 0; b < nblocks; ++b)
+    bend[b] = 0;
+  for (s = 0; s < n; ++s)
+    ++bend[block[s]];
+  for (b = 0, j = 0; b < nblocks; ++b)
+    if (bend[b] > bend[j])
+      j = b;
+  for (b = 0, i = 0; b < nblocks; ++b)
+    {
+      bfirst[b] = i;
+      i += bend[b];
+      bend[b] = bfirst[b];
+      nmarked[b] = 0;
+      in_work[b] = b != j;
+      if (b != j)
+	work[nwork++] = b;
+    }
+  for (s = 0; s < n; ++s)
+    {
+      pos[s] = bend[block[s]]++;
+      elems[pos[s]] = s;
+    }
+
+  while (nwork > 0)
+    {
+      Idx nsplitter;
+      b = work[--nwork];
+      in_work[b] = 0;
+      nsplitter = bend[b] - bfirst[b];
+      memcpy (splitter, elems + bfirst[b], nsplitter * sizeof (Idx));
+      for (a = 0; a < k; ++a)
+	{
+	  /* Mark the states moving into the splitter on A, by moving them
+	     to the front of their blocks.  Each state moves to a single
+	     state, so none is marked twice.  */
+	  ntouched = 0;
+	  for (i = 0; i < nsplitter; ++i)
+	    {
+	      Idx x = splitter[i] * k + a;
+	      for (j = inv_start[x]; j < inv_start[x + 1]; ++j)
+		{
+		  Idx p, other;
+		  s = inv[j];
+		  p = bfirst[block[s]] + nmarked[block[s]];
+		  other = elems[p];
+		  elems[pos[s]] = other;
+		  pos[other] = pos[s];
+		  elems[p] = s;
+		  pos[s] = p;
+		  if (nmarked[block[s]]++ == 0)
+		    touched[ntouched++] = block[s];
+		}
+	    }
+
+	  /* Split the blocks marked in part, and queue the new block, or
+	     the smaller half if the old one is not queued.  */
+	  for (i = 0; i < ntouched; ++i)
+	    {
+	      Idx old = touched[i], marked = nmarked[old];
+	      nmarked[old] = 0;
+	      if (marked == bend[old] - bfirst[old])
+		continue;
+	      b = nblocks++;
+	      bfirst[b] = bfirst[old];
+	      bend[b] = bfirst[old] + marked;
+	      bfirst[old] = bend[b];
+	      nmarked[b] = 0;
+	      in_work[b] = 0;
+	      for (j = bfirst[b]; j < bend[b]; ++j)
+		block[elems[j]] = b;
+	      if (!in_work[old] && bend[old] - bfirst[old] < marked)
+		b = old;
+	      in_work[b] = 1;
+	      work[nwork++] = b;
+	    }
+	}
+    }
+
+  /* Every block is represented by its first state in breadth first
+     order; those of the sink's block are dead.  */
+  sink = block[ns];
+  if (nblocks < n)
+    {
+      for (b = 0; b < nblocks; ++b)
+	rep[b] = -1;
+      for (s = 0; s < ns; ++s)
+	if (rep[block[s]] < 0)
+	  rep[block[s]] = s;
+
+      for (s = 0; s < ns; ++s)
+	if (block[s] != sink && rep[block[s]] == s)
+	  {
+	    re_dfastate_t *state = dfa->eager_states[s];
+	    re_dfastate_t **trtable;
+	    Idx ntrans;
+	    if (state->trtable != NULL)
+	      {
+		trtable = state->trtable;
+		ntrans = dfa->nbyte_classes;
+	      }
+	    else
+	      {
+		trtable = state->word_trtable;
+		ntrans = 2 * dfa->nbyte_classes;
+	      }
+	    for (j = 0; j < ntrans; ++j)
+	      if (trtable[j] != NULL)
+		{
+		  b = block[trans[s * k + j]];
+		  trtable[j] = b == sink ? NULL : dfa->eager_states[rep[b]];
+		}
+	  }
+
+      /* Move the states left to a new table, as there is no removing
+	 from an open addressing one.  */
+      old_table = dfa->state_table;
+      dfa->state_table = new_table;
+      for (i = 0; i < nslots; ++i)
+	{
+	  s = slot_index[i];
+	  if (old_table[i].state != NULL
+	      && (s < 0 || (block[s] != sink && rep[block[s]] == s)))
+	    insert_state (dfa, old_table[i].state);
+	}
+      new_table = old_table;
+
+      for (s = 0, nkept = 0; s < ns; ++s)
+	{
+	  re_dfastate_t *state = dfa->eager_states[s];
+	  if (block[s] != sink && rep[block[s]] == s)
+	    dfa->eager_states[nkept++] = state;
+	  else
+	    {
+	      size_t state_size = calc_state_size (state);
+	      size_t trtable_size = calc_trtable_size (dfa, state);
+	      --dfa->nstates;
+	      dfa->state_bytes -= state_size;
+	      dfa->trtable_bytes -= trtable_size;
+	      dfa->eager_bytes -= state_size + trtable_size;
+	      free_state (state);
+	    }
+	}
+      dfa->neager_states = nkept;
+      /* Shrink the list as re_dfa_materialize does, so that it holds what
+	 reg_get_mem_usage counts.  */
+      eager_states = re_realloc_tag (dfa->eager_states, re_dfastate_t *,
+				     nkept, REG_MEM_DFA_STATES);
+      if (eager_states != NULL)
+	dfa->eager_states = eager_states;
+    }
+  re_free (new_table);
+  re_free (buf);
+}
+
+/* Move the states built by re_dfa_materialize into DFA->eager_block,
+   numbered by their order in DFA->eager_states, and their transition
+   tables into DFA->eager_trtables with the numbers of the states in
+   place of pointers.  The matcher then finds the next state by adding to
+   the address of the block rather than loading it, and the whole DFA is
+   two allocations.  This runs at regcomp, when nothing else points to
+   the states.  Return false if memory runs out, leaving them as they
+   are.  */
+
+bool
+re_dfa_pack_eager (re_dfa_t *dfa)
+{
+  Idx ns = dfa->neager_states, nslots = dfa->state_hash_mask + 1, i, j, s;
+  size_t ntrans = 0, old_bytes = 0, new_bytes = 0;
+  Idx *slot_index;
+  re_dfastate_t *block;
+  re_state_id_t *trtables, *p;
+  re_dfastate_t **init_states[4];
+
+  if (__glibc_unlikely ((size_t) ns >= UINT32_MAX))
+    return false;
+  for (s = 0; s < ns; ++s)
+    ntrans += ((dfa->eager_states[s]->trtable != NULL ? 1 : 2)
+	       * dfa->nbyte_classes);
+  slot_index = re_malloc_tag (Idx, nslots, REG_MEM_DFA_STATES);
+  block = re_calloc_tag (sizeof (re_dfastate_t), ns + 1, REG_MEM_DFA_STATES);
+  trtables = re_malloc_tag (re_state_id_t, ntrans, REG_MEM_TRTABLES);
+  if (__glibc_unlikely (slot_index == NULL || block == NULL
+			|| trtables == NULL))
+    {
+      re_free (slot_index);
+      re_free (block);
+      re_free (trtables);
+      return false;
+    }
+
+  for (i = 0; i < nslots; ++i)
+    slot_index[i] = 0;
+  for (s = 0; s < ns; ++s)
+    slot_index[find_state_slot (dfa, dfa->eager_states[s])] = s + 1;
+
+  for (s = 0, p = trtables; s < ns; ++s)
+    {
+      re_dfastate_t *old = dfa->eager_states[s], *state = block + s + 1;
+      re_dfastate_t **trtable;
+      Idx ntrans1;
+
+      *state = *old;
+      if (old->entrance_nodes == &old->nodes)
+	state->entrance_nodes = &state->nodes;
+      if (old->trtable != NULL)
+	{
+	  trtable = old->trtable;
+	  ntrans1 = dfa->nbyte_classes;
+	}
+      else
+	{
+	  trtable = old->word_trtable;
+	  ntrans1 = 2 * dfa->nbyte_classes;
+	  state->eager_word = 1;
+	}
+      /* The transitions of these states lead only to each other.  */
+      for (j = 0; j < ntrans1; ++j)
+	p[j] = (trtable[j] == NULL ? 0
+		: slot_index[find_state_slot (dfa, trtable[j])]);
+      old_bytes += calc_trtable_size (dfa, old);
+      state->trtable = NULL;
+      state->word_trtable = NULL;
+      state->eager_trtable = p;
+      new_bytes += calc_trtable_size (dfa, state);
+      p += ntrans1;
+    }
+
+  /* Point everything at the block, then free the old states but for their
+     node sets, which moved.  */
+  init_states[0] = &dfa->init_state;
+  init_states[1] = &dfa->init_state_word;
+  init_states[2] = &dfa->init_state_nl;
+  init_states[3] = &dfa->init_state_begbuf;
+  for (i = 0; i < 4; ++i)
+    *init_states[i] = block + slot_index[find_state_slot (dfa,
+							  *init_states[i])];
+  for (i = 0; i < nslots; ++i)
+    if (slot_index[i] != 0)
+      dfa->state_table[i].state = block + slot_index[i];
+  for (s = 0; s < ns; ++s)
+    {
+      re_dfastate_t *old = dfa->eager_states[s];
+      re_free (old->trtable);
+      re_free (old->word_trtable);
+      re_free (old);
+      dfa->eager_states[s] = block + s + 1;
+    }
+
+  dfa->trtable_bytes = dfa->trtable_bytes - old_bytes + new_bytes;
+  dfa->eager_bytes = dfa->eager_bytes - old_bytes + new_bytes;
+  dfa->eager_block = block;
+  dfa->eager_trtables = trtables;
+  re_free (slot_index);
+  return true;
+}
+
 void
 free_state (re_dfastate_t *state)
 {
@@ -1618,7 +2434,9 @@ free_state (re_dfastate_t *state)
   re_node_set_free (&state->nodes);
   re_free (state->word_trtable);
   re_free (state->trtable);
-  re_free (state);
+  /* The states of DFA->eager_block go with it.  */
+  if (state->eager_trtable == NULL)
+    re_free (state);
 }
 
 /* Create the new state which is independent of contexts.
@@ -1633,7 +2451,8 @@ create_ci_newstate (const re_dfa_t *dfa, const re_node_set *nodes,
   reg_errcode_t err;
   re_dfastate_t *newstate;
 
-  newstate = (re_dfastate_t *) re_calloc (sizeof (re_dfastate_t), 1);
+  newstate = (re_dfastate_t *) re_calloc_tag (sizeof (re_dfastate_t), 1,
+					      REG_MEM_DFA_STATES);
   if (__glibc_unlikely (newstate == NULL))
     return NULL;
   err = re_node_set_init_copy (&newstate->nodes, nodes);
@@ -1646,7 +2465,7 @@ create_ci_newstate (const re_dfa_t *dfa, const re_node_set *nodes,
   newstate->entrance_nodes = &newstate->nodes;
   for (i = 0 ; i < nodes->nelem ; i++)
     {
-      re_token_t *node = dfa->nodes + nodes->elems[i];
+      re_token_t *node = dfa->nodes + re_node_set_elems (nodes)[i];
       re_token_type_t type = node->type;
       if (type == CHARACTER && !node->constraint)
 	continue;
@@ -1683,7 +2502,8 @@ create_cd_newstate (const re_dfa_t *dfa, const re_node_set *nodes,
   reg_errcode_t err;
   re_dfastate_t *newstate;
 
-  newstate = (re_dfastate_t *) re_calloc (sizeof (re_dfastate_t), 1);
+  newstate = (re_dfastate_t *) re_calloc_tag (sizeof (re_dfastate_t), 1,
+					      REG_MEM_DFA_STATES);
   if (__glibc_unlikely (newstate == NULL))
     return NULL;
   err = re_node_set_init_copy (&newstate->nodes, nodes);
@@ -1698,7 +2518,7 @@ create_cd_newstate (const re_dfa_t *dfa, const re_node_set *nodes,
 
   for (i = 0 ; i < nodes->nelem ; i++)
     {
-      re_token_t *node = dfa->nodes + nodes->elems[i];
+      re_token_t *node = dfa->nodes + re_node_set_elems (nodes)[i];
       re_token_type_t type = node->type;
       unsigned int constraint = node->constraint;
 
@@ -1718,7 +2538,8 @@ create_cd_newstate (const re_dfa_t *dfa, const re_node_set *nodes,
 	{
 	  if (newstate->entrance_nodes == &newstate->nodes)
 	    {
-	      newstate->entrance_nodes = re_malloc (re_node_set, 1);
+	      newstate->entrance_nodes = re_malloc_tag (re_node_set, 1,
+							REG_MEM_NODE_SETS);
 	      if (__glibc_unlikely (newstate->entrance_nodes == NULL))
 		{
 		  free_state (newstate);
@@ -40,7 +40,9 @@ static reg_errcode_t re_search_internal (const regex_t *preg,
 					 const char *string, Idx length,
 					 Idx start, Idx last_start, Idx stop,
 					 size_t nmatch, regmatch_t pmatch[],
-					 int eflags);
+					 int eflags, bool shared);
+static bool search_is_shared (const regex_t *preg, size_t nmatch);
+static bool enter_shared_search (re_dfa_t *dfa);
 static regoff_t re_search_2_stub (struct re_pattern_buffer *bufp,
 				  const char *string1, Idx length1,
 				  const char *string2, Idx length2,
@@ -161,6 +163,49 @@ static reg_errcode_t expand_bkref_cache (re_match_context_t *mctx,
 					 re_node_set *cur_nodes, Idx cur_str,
 					 Idx subexp_num, int type);
 static bool build_trtable (const re_dfa_t *dfa, re_dfastate_t *state);
+static void merge_match_stats (re_dfa_t *dfa, const reg_stats_t *stats);
+static bool cache_over_budget (const re_dfa_t *dfa);
+static void flush_over_budget (const re_dfa_t *dfa, re_dfastate_t *keep,
+			       Idx nshared);
+
+/* How re_search_internal executes a search, see plan_search.  */
+typedef struct
+{
+  int match_kind;
+  bool fl_longest_match;
+  bool anchored;
+  bool need_state_log;
+  bool need_prune;
+  bool need_set_regs;
+  bool use_literal;
+  bool use_pure_literal;
+  bool use_reverse;
+} re_search_plan_t;
+
+static void plan_search (const regex_t *preg, size_t nmatch, bool use_fastmap,
+			 bool forward, re_search_plan_t *plan);
+static Idx find_required_literal (const re_dfa_t *dfa, const char *string,
+				  Idx from, Idx stop);
+static Idx find_pure_literal (const re_pure_literal_t *lit,
+			      const char *string, Idx from, Idx last_start,
+			      Idx stop);
+static Idx find_leftmost_start (const regex_t *preg, const char *string,
+				Idx length, Idx start, Idx stop, int eflags,
+				bool shared);
+static Idx scan_fastmap (const re_fastmap_scan_t *scan, const char *string,
+			 Idx from, Idx to);
+static Idx scan_fastmap_word (const re_fastmap_scan_t *scan,
+			      const char *string, Idx from, Idx to);
+#ifdef RE_HAVE_SIMD_SCAN
+static Idx scan_fastmap_sse2 (const re_fastmap_scan_t *scan,
+			      const char *string, Idx from, Idx to);
+static Idx scan_fastmap_ssse3 (const re_fastmap_scan_t *scan,
+			       const char *string, Idx from, Idx to)
+     re_target ("ssse3");
+static Idx scan_fastmap_avx2 (const re_fastmap_scan_t *scan,
+			      const char *string, Idx from, Idx to)
+     re_target ("avx2");
+#endif
 #ifdef RE_ENABLE_I18N
 static int check_node_accept_bytes (const re_dfa_t *dfa, Idx node_idx,
 				    const re_string_t *input, Idx idx);
@@ -215,17 +260,56 @@ regexec (const regex_t *_Restrict_ preg, const char *_Restrict_ string,
       length = (Idx)strlen (string);
     }
 
-  lock_lock (dfa->lock);
   if (preg->no_sub)
-    err = re_search_internal (preg, string, length, start, length,
-			      length, 0, NULL, eflags);
-  else
-    err = re_search_internal (preg, string, length, start, length,
-			      length, nmatch, pmatch, eflags);
+    {
+      nmatch = 0;
+      pmatch = NULL;
+    }
+  if (search_is_shared (preg, nmatch) && enter_shared_search (dfa))
+    return re_search_internal (preg, string, length, start, length,
+			       length, nmatch, pmatch, eflags,
+			       true) != REG_NOERROR;
+
+  lock_lock (dfa->lock);
+  err = re_search_internal (preg, string, length, start, length,
+			    length, nmatch, pmatch, eflags, false);
   lock_unlock (dfa->lock);
   return err != REG_NOERROR;
 }
 
+/* Return true if a search of PREG for NMATCH registers may run without
+   DFA->lock.  Such a search keeps no state log, so it only refers to the
+   state it is in: it takes the lock just to build a transition table or
+   an initial state, and publishes the table with re_atomic_store_release
+   for the other searches, which read it without the lock.  */
+
+static bool
+search_is_shared (const regex_t *preg, size_t nmatch)
+{
+#ifdef RE_HAVE_ATOMICS
+  const re_dfa_t *dfa = preg->buffer;
+
+  return !dfa->has_mb_node && (nmatch <= 1 || preg->re_nsub == 0);
+#else
+  return false;
+#endif
+}
+
+/* Count a search of DFA that runs without DFA->lock among DFA->nshared,
+   so that the cache is not flushed under it, see flush_over_budget.
+   Return false if a flush is pending; the search then takes the lock,
+   which lets the shared searches drain.  */
+
+static bool
+enter_shared_search (re_dfa_t *dfa)
+{
+  re_atomic_add (&dfa->nshared, 1);
+  if (__glibc_likely (!re_atomic_get (&dfa->flush_pending)))
+    return true;
+  re_atomic_add (&dfa->nshared, -1);
+  return false;
+}
+
 #ifdef _LIBC
 libc_hidden_def (__regexec)
 
@@ -340,7 +424,7 @@ re_search_2_stub (struct re_pattern_buffer *bufp, const char *string1,
   if (length2 > 0)
     if (length1 > 0)
       {
-	s = re_malloc (char, len);
+	s = re_malloc_tag (char, len, REG_MEM_MATCH_CONTEXT);
 
 	if (__glibc_unlikely (s == NULL))
 	  return -2;
@@ -380,6 +464,7 @@ re_search_stub (struct re_pattern_buffer *bufp, const char *string, Idx length,
   int eflags = 0;
   re_dfa_t *dfa = bufp->buffer;
   Idx last_start = start + range;
+  bool shared;
 
   /* Check for out-of-range.  */
   if (__glibc_unlikely (start < 0 || start > length))
@@ -419,15 +504,21 @@ re_search_stub (struct re_pattern_buffer *bufp, const char *string, Idx length,
     }
   else
         nregs = (Idx)(bufp->re_nsub + 1);
-  pmatch = re_malloc (regmatch_t, nregs);
+  pmatch = re_malloc_tag (regmatch_t, nregs, REG_MEM_MATCH_CONTEXT);
   if (__glibc_unlikely (pmatch == NULL))
     {
       rval = -2;
       goto out;
     }
 
+  /* Without registers to copy, which BUFP records the allocation of, the
+     lock is not needed any more.  */
+  shared = (regs == NULL && search_is_shared (bufp, nregs)
+	    && enter_shared_search (dfa));
+  if (shared)
+    lock_unlock (dfa->lock);
   result = re_search_internal (bufp, string, length, start, last_start, stop,
-			       nregs, pmatch, eflags);
+			       nregs, pmatch, eflags, shared);
 
   rval = 0;
 
@@ -454,6 +545,8 @@ re_search_stub (struct re_pattern_buffer *bufp, const char *string, Idx length,
 	rval = pmatch[0].rm_so;
     }
   re_free (pmatch);
+  if (shared)
+    return rval;
  out:
   lock_unlock (dfa->lock);
   return rval;
@@ -472,10 +565,10 @@ re_copy_regs (struct re_registers *regs, regmatch_t *pmatch, Idx nregs,
   /* Have the register data arrays been allocated?  */
   if (regs_allocated == REGS_UNALLOCATED)
     { /* No.  So allocate them with malloc.  */
-      regs->start = re_malloc (regoff_t, need_regs);
+      regs->start = re_malloc_tag (regoff_t, need_regs, REG_MEM_MATCH_CONTEXT);
       if (__glibc_unlikely (regs->start == NULL))
 	return REGS_UNALLOCATED;
-      regs->end = re_malloc (regoff_t, need_regs);
+      regs->end = re_malloc_tag (regoff_t, need_regs, REG_MEM_MATCH_CONTEXT);
       if (__glibc_unlikely (regs->end == NULL))
 	{
 	  re_free (regs->start);
@@ -489,11 +582,14 @@ re_copy_regs (struct re_registers *regs, regmatch_t *pmatch, Idx nregs,
 	 leave it alone.  */
       if (__glibc_unlikely ((__re_size_t)need_regs > regs->num_regs))
 	{
-	  regoff_t *new_start = re_realloc (regs->start, regoff_t, need_regs);
+	  regoff_t *new_start = re_realloc_tag (regs->start, regoff_t,
+						need_regs,
+						REG_MEM_MATCH_CONTEXT);
 	  regoff_t *new_end;
 	  if (__glibc_unlikely (new_start == NULL))
 	    return REGS_UNALLOCATED;
-	  new_end = re_realloc (regs->end, regoff_t, need_regs);
+	  new_end = re_realloc_tag (regs->end, regoff_t, need_regs,
+				    REG_MEM_MATCH_CONTEXT);
 	  if (__glibc_unlikely (new_end == NULL))
 	    {
 	      re_free (new_start);
@@ -582,24 +678,30 @@ re_exec (const char *s)
    Return REG_NOERROR if we find a match, and REG_NOMATCH if not,
    otherwise return the error code.
    Note: We assume front end functions already check ranges.
-   (0 <= LAST_START && LAST_START <= LENGTH)  */
+   (0 <= LAST_START && LAST_START <= LENGTH)
+   The caller holds DFA->lock, unless SHARED says that the search may run
+   without it, see search_is_shared.  */
 
 static reg_errcode_t
 __attribute_warn_unused_result__
 re_search_internal (const regex_t *preg, const char *string, Idx length,
 		    Idx start, Idx last_start, Idx stop, size_t nmatch,
-		    regmatch_t pmatch[], int eflags)
+		    regmatch_t pmatch[], int eflags, bool shared)
 {
   reg_errcode_t err;
   const re_dfa_t *dfa = preg->buffer;
   Idx left_lim, right_lim;
   int incr;
-  bool fl_longest_match;
-  int match_kind;
+  re_search_plan_t plan;
   Idx match_first;
+  Idx fastmap_start;
+  Idx lit_pos = -1;
+  Idx failed_bytes = 0;
   Idx match_last = -1;
   Idx extra_nmatch;
+#ifdef RE_ENABLE_I18N
   bool sb;
+#endif
   int ch;
 #if defined _LIBC || (defined __STDC_VERSION__ && __STDC_VERSION__ >= 199901L)
   re_match_context_t mctx = { .dfa = dfa };
@@ -615,46 +717,60 @@ re_search_internal (const regex_t *preg, const char *string, Idx length,
   memset (&mctx, '\0', sizeof (re_match_context_t));
   mctx.dfa = dfa;
 #endif
+  mctx.shared = shared;
 
   extra_nmatch = (Idx)((nmatch > preg->re_nsub) ? nmatch - (preg->re_nsub + 1) : 0);
   nmatch -= extra_nmatch;
 
-  /* Check if the DFA haven't been compiled.  */
+  re_trace (EXEC_ENTRY, length, start);
+
+  /* Check if the DFA haven't been compiled.  The early exits below go
+     through free_return, which leaves a shared search.  */
+  err = REG_NOMATCH;
   if (__glibc_unlikely (preg->used == 0 || dfa->init_state == NULL
 			|| dfa->init_state_word == NULL
 			|| dfa->init_state_nl == NULL
 			|| dfa->init_state_begbuf == NULL))
-    return REG_NOMATCH;
+    goto free_return;
 
 #ifdef DEBUG
   /* We assume front-end functions already check them.  */
   assert (0 <= last_start && last_start <= length);
 #endif
 
-  /* If initial states with non-begbuf contexts have no elements,
-     the regex must be anchored.  If preg->newline_anchor is set,
-     we'll never use init_state_nl, so do not check it.  */
-  if (dfa->init_state->nodes.nelem == 0
-      && dfa->init_state_word->nodes.nelem == 0
-      && (dfa->init_state_nl->nodes.nelem == 0
-	  || !preg->newline_anchor))
+  plan_search (preg, nmatch, fastmap != NULL, start <= last_start, &plan);
+  if (plan.anchored)
     {
       if (start != 0 && last_start != 0)
-        return REG_NOMATCH;
+        goto free_return;
       start = last_start = 0;
     }
-
-  /* ƥģʽδȷ򱣳ԭ߼ */
-  if (preg->fl_longest_match == 2)
-  {
-      /* We must check the longest matching, if nmatch > 0.  */
-      fl_longest_match = (nmatch != 0 || dfa->nbackref);
-  }
-  else
-  {
-      /* TRUḚģʽƥ䣩FALSḚģʽСƥ䣩 */
-      fl_longest_match = preg->fl_longest_match;
-  }
+
+  /* A plain literal is looked for as a string, without the input
+     buffer and the DFA.  It has no subexpression to fill.  */
+  if (plan.use_pure_literal)
+    {
+      Idx reg_idx;
+
+      ++mctx.stats.npure_literal;
+      match_first = find_pure_literal (dfa->pure_lit, string, start,
+				       last_start, stop);
+      err = REG_NOMATCH;
+      if (match_first == -1)
+	goto free_return;
+      err = REG_NOERROR;
+      if (nmatch > 0)
+	{
+	  pmatch[0].rm_so = match_first;
+	  pmatch[0].rm_eo = match_first + dfa->pure_lit->len;
+	}
+      for (reg_idx = 0; reg_idx < extra_nmatch; ++reg_idx)
+	{
+	  pmatch[nmatch + reg_idx].rm_so = -1;
+	  pmatch[nmatch + reg_idx].rm_eo = -1;
+	}
+      goto free_return;
+    }
 
   err = re_string_allocate (&mctx.input, string, length, (Idx)(dfa->nodes_len + 1),
 			    preg->translate, (preg->syntax & RE_ICASE) != 0,
@@ -669,11 +785,7 @@ re_search_internal (const regex_t *preg, const char *string, Idx length,
   if (__glibc_unlikely (err != REG_NOERROR))
     goto free_return;
 
-  /* We will log all the DFA states through which the dfa pass,
-     if nmatch > 1, or this dfa has "multibyte node", which is a
-     back-reference or a node which can accept multibyte character or
-     multi character collating element.  */
-  if (nmatch > 1 || dfa->has_mb_node)
+  if (plan.need_state_log)
     {
       /* Avoid overflow.  */
       if (__glibc_unlikely ((MIN (IDX_MAX, SIZE_MAX / sizeof (re_dfastate_t *))
@@ -683,7 +795,8 @@ re_search_internal (const regex_t *preg, const char *string, Idx length,
 	  goto free_return;
 	}
 
-      mctx.state_log = re_malloc (re_dfastate_t *, mctx.input.bufs_len + 1);
+      mctx.state_log = re_malloc_tag (re_dfastate_t *, mctx.input.bufs_len + 1,
+				      REG_MEM_STATE_LOG);
       if (__glibc_unlikely (mctx.state_log == NULL))
 	{
 	  err = REG_ESPACE;
@@ -701,13 +814,9 @@ re_search_internal (const regex_t *preg, const char *string, Idx length,
   incr = (last_start < start) ? -1 : 1;
   left_lim = (last_start < start) ? last_start : start;
   right_lim = (last_start < start) ? start : last_start;
+#ifdef RE_ENABLE_I18N
   sb = dfa->mb_cur_max == 1;
-  match_kind =
-    (fastmap
-     ? ((sb || !(preg->syntax & RE_ICASE || t) ? 4 : 0)
-	| (start <= last_start ? 2 : 0)
-	| (t != NULL ? 1 : 0))
-     : 8);
+#endif
 
   for (;; match_first += incr)
     {
@@ -715,12 +824,37 @@ re_search_internal (const regex_t *preg, const char *string, Idx length,
       if (match_first < left_lim || right_lim < match_first)
 	goto free_return;
 
+      /* A match starting at MATCH_FIRST holds the required literal at
+	 or after MATCH_FIRST: search it again once MATCH_FIRST passes
+	 the last one found, and jump to it if every match starts with
+	 it.  Backward, just check once that the string holds it.  */
+      if (plan.use_literal
+	  && (incr > 0 ? lit_pos < match_first : lit_pos == -1))
+	{
+	  lit_pos = find_required_literal (dfa, string,
+					   incr > 0 ? match_first : left_lim,
+					   stop);
+	  if (lit_pos == -1 || (incr > 0 && dfa->req_at_start
+				&& lit_pos > right_lim))
+	    {
+	      mctx.stats.literal_skipped += (incr > 0
+					     ? right_lim - match_first + 1
+					     : match_first - left_lim + 1);
+	      goto free_return;
+	    }
+	  if (incr > 0 && dfa->req_at_start)
+	    {
+	      mctx.stats.literal_skipped += lit_pos - match_first;
+	      match_first = lit_pos;
+	    }
+	}
+
       /* Advance as rapidly as possible through the string, until we
 	 find a plausible place to start matching.  This may be done
 	 with varying efficiency, so there are various possibilities:
 	 only the most common of them are specialized, in order to
 	 save on code size.  We use a switch statement for speed.  */
-      switch (match_kind)
+      switch (plan.match_kind)
 	{
 	case 8:
 	  /* No fastmap.  */
@@ -728,30 +862,46 @@ re_search_internal (const regex_t *preg, const char *string, Idx length,
 
 	case 7:
 	  /* Fastmap with single-byte translation, match forward.  */
-	  while (__glibc_likely (match_first < right_lim)
-		 && !fastmap[t[(unsigned char) string[match_first]]])
-	    ++match_first;
+	  fastmap_start = match_first;
+	  if (__glibc_likely (dfa->fastmap_scan.translate == t))
+	    match_first = scan_fastmap (&dfa->fastmap_scan, string,
+					match_first, right_lim);
+	  else
+	    while (__glibc_likely (match_first < right_lim)
+		   && !fastmap[t[(unsigned char) string[match_first]]])
+	      ++match_first;
 	  goto forward_match_found_start_or_reached_end;
 
 	case 6:
 	  /* Fastmap without translation, match forward.  */
-	  while (__glibc_likely (match_first < right_lim)
-		 && !fastmap[(unsigned char) string[match_first]])
-	    ++match_first;
+	  fastmap_start = match_first;
+	  if (__glibc_likely (dfa->fastmap_scan.translate == NULL))
+	    match_first = scan_fastmap (&dfa->fastmap_scan, string,
+					match_first, right_lim);
+	  else
+	    while (__glibc_likely (match_first < right_lim)
+		   && !fastmap[(unsigned char) string[match_first]])
+	      ++match_first;
 
 	forward_match_found_start_or_reached_end:
+	  mctx.stats.fastmap_scanned += match_first - fastmap_start + 1;
+	  mctx.stats.fastmap_skipped += match_first - fastmap_start;
 	  if (__glibc_unlikely (match_first == right_lim))
 	    {
 	      ch = match_first >= length
 		       ? 0 : (unsigned char) string[match_first];
 	      if (!fastmap[t ? t[ch] : ch])
-		goto free_return;
+		{
+		  ++mctx.stats.fastmap_skipped;
+		  goto free_return;
+		}
 	    }
 	  break;
 
 	case 4:
 	case 5:
 	  /* Fastmap without multi-byte translation, match backwards.  */
+	  fastmap_start = match_first;
 	  while (match_first >= left_lim)
 	    {
 	      ch = match_first >= length
@@ -760,6 +910,9 @@ re_search_internal (const regex_t *preg, const char *string, Idx length,
 		break;
 	      --match_first;
 	    }
+	  mctx.stats.fastmap_skipped += fastmap_start - match_first;
+	  mctx.stats.fastmap_scanned += fastmap_start - match_first
+					+ (match_first >= left_lim);
 	  if (match_first < left_lim)
 	    goto free_return;
 	  break;
@@ -787,8 +940,10 @@ re_search_internal (const regex_t *preg, const char *string, Idx length,
 		 Note that MATCH_FIRST must not be smaller than 0.  */
 	      ch = (match_first >= length
 		    ? 0 : re_string_byte_at (&mctx.input, offset));
+	      ++mctx.stats.fastmap_scanned;
 	      if (fastmap[ch])
 		break;
+	      ++mctx.stats.fastmap_skipped;
 	      match_first += incr;
 	      if (match_first < left_lim || match_first > right_lim)
 		{
@@ -815,8 +970,10 @@ re_search_internal (const regex_t *preg, const char *string, Idx length,
       /* It seems to be appropriate one, then use the matcher.  */
       /* We assume that the matching starts from 0.  */
       mctx.state_log_top = mctx.nbkref_ents = mctx.max_mb_elem_len = 0;
-      match_last = check_matching (&mctx, fl_longest_match,
+      ++mctx.stats.ncheck_matching;
+      match_last = check_matching (&mctx, plan.fl_longest_match,
 				   start <= last_start ? &match_first : NULL);
+      mctx.stats.dfa_bytes += re_string_cur_idx (&mctx.input);
       if (match_last != -1)
 	{
 	  if (__glibc_unlikely (match_last == -2))
@@ -833,8 +990,7 @@ re_search_internal (const regex_t *preg, const char *string, Idx length,
 		  mctx.last_node = check_halt_state_context (&mctx, pstate,
 							     match_last);
 		}
-	      if ((!preg->no_sub && nmatch > 1 && dfa->has_plural_match)
-		  || dfa->nbackref)
+	      if (plan.need_prune)
 		{
 		  err = prune_impossible_nodes (&mctx);
 		  if (err == REG_NOERROR)
@@ -848,7 +1004,29 @@ re_search_internal (const regex_t *preg, const char *string, Idx length,
 	    }
 	}
 
+      ++mctx.stats.nrestarts;
       match_ctx_clean (&mctx);
+
+      /* Once the failed attempts have read more than twice the rest
+	 of the string, as those of "[a-z]+X" do over a run of letters,
+	 find the leftmost start up to STOP in one pass of the reversed
+	 pattern over it, and jump there.  The starts past STOP are
+	 still tried one by one.  */
+      failed_bytes += re_string_cur_idx (&mctx.input);
+      if (plan.use_reverse && match_first < stop
+	  && failed_bytes > 2 * (stop - match_first) + RE_REVERSE_SLACK)
+	{
+	  Idx rev_start;
+	  plan.use_reverse = false;
+	  rev_start = find_leftmost_start (preg, string, length,
+					   match_first + 1, stop, eflags,
+					   shared);
+	  if (rev_start != -2)
+	    {
+	      ++mctx.stats.nreverse;
+	      match_first = rev_start == -1 ? stop : rev_start - 1;
+	    }
+	}
     }
 
 #ifdef DEBUG
@@ -872,8 +1050,9 @@ re_search_internal (const regex_t *preg, const char *string, Idx length,
 	 the maximum possible regoff_t value.  We need a new error
 	 code REG_OVERFLOW.  */
 
-      if (!preg->no_sub && nmatch > 1)
+      if (plan.need_set_regs)
 	{
+	  ++mctx.stats.nset_regs;
 	  err = set_regs (preg, &mctx, nmatch, pmatch,
 			  dfa->has_plural_match && dfa->nbackref > 0);
 	  if (__glibc_unlikely (err != REG_NOERROR))
@@ -926,9 +1105,444 @@ re_search_internal (const regex_t *preg, const char *string, Idx length,
   if (dfa->nbackref)
     match_ctx_free (&mctx);
   re_string_destruct (&mctx.input);
+  if (shared)
+    {
+      re_dfa_t *mdfa = preg->buffer;
+      lock_lock (mdfa->lock);
+      merge_match_stats (mdfa, &mctx.stats);
+      re_atomic_add (&mdfa->nshared, -1);
+      flush_over_budget (dfa, NULL, 0);
+      lock_unlock (mdfa->lock);
+    }
+  else
+    {
+      flush_over_budget (dfa, NULL, 0);
+      merge_match_stats (preg->buffer, &mctx.stats);
+    }
+  re_trace (EXEC_EXIT, err, err == REG_NOERROR ? match_first : -1);
   return err;
 }
 
+/* Fill PLAN with the way re_search_internal searches PREG, once NMATCH
+   has been clipped to the number of subexpressions.  USE_FASTMAP tells
+   whether the fastmap may be used, FORWARD whether the start position
+   increases.  */
+
+static void
+plan_search (const regex_t *preg, size_t nmatch, bool use_fastmap,
+	     bool forward, re_search_plan_t *plan)
+{
+  const re_dfa_t *dfa = preg->buffer;
+  RE_TRANSLATE_TYPE t = preg->translate;
+
+  /* If initial states with non-begbuf contexts have no elements,
+     the regex must be anchored.  If preg->newline_anchor is set,
+     we'll never use init_state_nl, so do not check it.  Anchored
+     searches only try the start of the string.  */
+  plan->anchored = (dfa->init_state->nodes.nelem == 0
+		    && dfa->init_state_word->nodes.nelem == 0
+		    && (dfa->init_state_nl->nodes.nelem == 0
+			|| !preg->newline_anchor));
+  if (plan->anchored)
+    forward = true;
+
+  /* ƥģʽδȷ򱣳ԭ߼ */
+  if (preg->fl_longest_match == 2)
+    /* We must check the longest matching, if nmatch > 0.  */
+    plan->fl_longest_match = (nmatch != 0 || dfa->nbackref);
+  else
+    /* TRUḚģʽƥ䣩FALSḚģʽСƥ䣩 */
+    plan->fl_longest_match = preg->fl_longest_match;
+
+  /* We will log all the DFA states through which the dfa pass,
+     if nmatch > 1, or this dfa has "multibyte node", which is a
+     back-reference or a node which can accept multibyte character or
+     multi character collating element.  */
+  plan->need_state_log = nmatch > 1 || dfa->has_mb_node;
+  plan->need_prune = ((!preg->no_sub && nmatch > 1 && dfa->has_plural_match)
+		      || dfa->nbackref);
+  plan->need_set_regs = !preg->no_sub && nmatch > 1;
+
+  plan->match_kind =
+    (use_fastmap
+     ? ((dfa->mb_cur_max == 1 || !(preg->syntax & RE_ICASE || t) ? 4 : 0)
+	| (forward ? 2 : 0)
+	| (t != NULL ? 1 : 0))
+     : 8);
+
+  /* The literal is that of the pattern, not of translated text.  */
+  plan->use_literal = dfa->req_len != 0 && t == NULL;
+
+  /* See calc_pure_literal; a backward search is left to the DFA.  */
+  plan->use_pure_literal = dfa->pure_lit != NULL && forward;
+
+  /* See find_leftmost_start.  */
+  plan->use_reverse = (forward && !plan->anchored
+		       && (dfa->master != NULL
+			   ? dfa->master : dfa)->rev_pattern != NULL);
+}
+
+/* Return the leftmost position from START on where a match of PREG in
+   STRING, of length LENGTH, starts and ends by STOP, or -1 if there is
+   none, or -2 if the reversed pattern could not be run.  EFLAGS and
+   SHARED are those of the forward search, see re_search_internal.
+
+   The pattern compiled by re_compile_reverse matches the reversed text,
+   and its loop over any byte lets a match start anywhere: the longest
+   match of it from STOP back to START ends at the leftmost start, in a
+   single pass.  The reversed copy takes the byte before START and the
+   one at STOP along, for the anchors.  The reversed pattern belongs to
+   the master DFA; it is compiled on the first call, under the master's
+   lock, and searched like regexec would.  */
+
+static Idx
+find_leftmost_start (const regex_t *preg, const char *string, Idx length,
+		     Idx start, Idx stop, int eflags, bool shared)
+{
+  const re_dfa_t *dfa = preg->buffer;
+  re_dfa_t *mdfa = (re_dfa_t *) (dfa->master != NULL ? dfa->master : dfa);
+  bool locked = !shared && dfa->master == NULL;
+  regex_t *rev;
+  re_dfa_t *rdfa;
+  regmatch_t m;
+  reg_errcode_t err;
+  Idx from, end, n, i;
+  char *text;
+  int rflags;
+  bool rshared;
+
+  if (!locked)
+    lock_lock (mdfa->lock);
+  rev = mdfa->reverse;
+  if (rev == NULL && !mdfa->reverse_failed)
+    {
+      if (re_compile_reverse (preg, &rev) == REG_NOERROR)
+	mdfa->reverse = rev;
+      else
+	{
+	  mdfa->reverse_failed = 1;
+	  rev = NULL;
+	}
+    }
+  if (!locked)
+    lock_unlock (mdfa->lock);
+  if (rev == NULL)
+    return -2;
+
+  from = start > 0 ? start - 1 : 0;
+  end = stop < length ? stop + 1 : length;
+  n = end - from;
+  text = re_malloc_tag (char, n + 1, REG_MEM_MATCH_CONTEXT);
+  if (__glibc_unlikely (text == NULL))
+    return -2;
+  for (i = 0; i < n; ++i)
+    text[i] = string[end - 1 - i];
+
+  /* The start of the text is the end of the reversed text.  */
+  rflags = (((eflags & REG_NOTBOL) ? REG_NOTEOL : 0)
+	    | ((eflags & REG_NOTEOL) ? REG_NOTBOL : 0));
+  rdfa = rev->buffer;
+  rshared = search_is_shared (rev, 1) && enter_shared_search (rdfa);
+  if (!rshared)
+    lock_lock (rdfa->lock);
+  err = re_search_internal (rev, text, n, end - stop, end - stop,
+			    end - start, 1, &m, rflags, rshared);
+  if (!rshared)
+    lock_unlock (rdfa->lock);
+  re_free (text);
+
+  if (err == REG_NOMATCH)
+    return -1;
+  if (__glibc_unlikely (err != REG_NOERROR))
+    return -2;
+  return end - m.rm_eo;
+}
+
+/* Return the first position from FROM to LAST_START at which STRING
+   holds the literal LIT, ending by STOP, or -1.  The search runs the
+   automaton of Knuth, Morris and Pratt over the bytes of STRING seen
+   through LIT->fold, so it reads each byte once; while no prefix of
+   LIT is pending, it skips to the next byte that may start LIT with
+   scan_fastmap.  */
+
+static Idx
+find_pure_literal (const re_pure_literal_t *lit, const char *string,
+		   Idx from, Idx last_start, Idx stop)
+{
+  const unsigned char *s = (const unsigned char *) string;
+  Idx last = MIN (last_start, stop - lit->len);
+  Idx i = from, k = 0;
+
+  /* K bytes of LIT end before I: a match may start at I - K.  */
+  while (i - k <= last)
+    {
+      if (k == 0)
+	{
+	  i = scan_fastmap (&lit->first, string, i, last);
+	  if (i == last && !lit->first.map[s[last]])
+	    return -1;
+	  k = 1;
+	}
+      else
+	{
+	  unsigned char c = lit->fold[s[i]];
+	  while (k > 0 && lit->bytes[k] != c)
+	    k = lit->border[k];
+	  if (lit->bytes[k] == c)
+	    ++k;
+	}
+      ++i;
+      if (k == lit->len)
+	return i - k;
+    }
+  return -1;
+}
+
+/* Return the first position from FROM on at which STRING holds the
+   literal every match of DFA contains, ending by STOP, or -1.  */
+
+static Idx
+find_required_literal (const re_dfa_t *dfa, const char *string, Idx from,
+		       Idx stop)
+{
+  const unsigned char *lit = dfa->req_lit;
+  Idx len = dfa->req_len;
+  const char *p = string + from, *last;
+
+  if (stop - from < len)
+    return -1;
+  last = string + stop - len;
+  while ((p = memchr (p, lit[0], last - p + 1)) != NULL)
+    {
+      if (memcmp (p + 1, lit + 1, len - 1) == 0)
+	return p - string;
+      ++p;
+    }
+  return -1;
+}
+
+/* Return the first position from FROM before TO at which SCAN lets a
+   forward search start, or TO.  The vector kernels below skip whole
+   blocks of bytes and leave the last few to the loop here.  */
+
+static Idx
+scan_fastmap (const re_fastmap_scan_t *scan, const char *string, Idx from,
+	      Idx to)
+{
+  const char *p;
+
+  if (scan->nbytes == 0)
+    return to;
+  switch (scan->kind)
+    {
+    case RE_SCAN_MEMCHR:
+      p = memchr (string + from, scan->value[0], to - from);
+      return p != NULL ? p - string : to;
+    case RE_SCAN_WORD:
+      from = scan_fastmap_word (scan, string, from, to);
+      break;
+#ifdef RE_HAVE_SIMD_SCAN
+    case RE_SCAN_SSE2:
+      from = scan_fastmap_sse2 (scan, string, from, to);
+      break;
+    case RE_SCAN_SSSE3:
+      from = scan_fastmap_ssse3 (scan, string, from, to);
+      break;
+    case RE_SCAN_AVX2:
+      from = scan_fastmap_avx2 (scan, string, from, to);
+      break;
+#endif
+    default:
+      break;
+    }
+  while (from < to && !scan->map[(unsigned char) string[from]])
+    ++from;
+  return from;
+}
+
+/* Scan a word at a time for the values of SCAN, as memchr does without
+   vector instructions: a byte of (W | MASK) ^ VALUE is zero where W
+   holds one of the bytes.  Return the start of the first word holding
+   one, or where less than a word remains before TO.  */
+
+static Idx
+scan_fastmap_word (const re_fastmap_scan_t *scan, const char *string,
+		   Idx from, Idx to)
+{
+  const unsigned long ones = (unsigned long) -1 / 0xff;
+  const unsigned long highs = ones << 7;
+  unsigned long masks[3], values[3], w, x;
+  int i, n = scan->nvalues;
+
+  for (i = 0; i < n; ++i)
+    {
+      masks[i] = scan->or_mask[i] * ones;
+      values[i] = scan->value[i] * ones;
+    }
+  for (; to - from >= (Idx) sizeof w; from += sizeof w)
+    {
+      memcpy (&w, string + from, sizeof w);
+      for (i = 0; i < n; ++i)
+	{
+	  x = (w | masks[i]) ^ values[i];
+	  if ((x - ones) & ~x & highs)
+	    return from;
+	}
+    }
+  return from;
+}
+
+#ifdef RE_HAVE_SIMD_SCAN
+/* Likewise 16 bytes at a time.  Return the position of the first byte
+   found, or where fewer than 16 bytes remain before TO.  */
+
+static Idx
+scan_fastmap_sse2 (const re_fastmap_scan_t *scan, const char *string,
+		   Idx from, Idx to)
+{
+  int n = scan->nvalues;
+  __m128i m0 = _mm_set1_epi8 ((char) scan->or_mask[0]);
+  __m128i m1 = _mm_set1_epi8 ((char) scan->or_mask[n > 1]);
+  __m128i m2 = _mm_set1_epi8 ((char) scan->or_mask[n - 1]);
+  __m128i v0 = _mm_set1_epi8 ((char) scan->value[0]);
+  __m128i v1 = _mm_set1_epi8 ((char) scan->value[n > 1]);
+  __m128i v2 = _mm_set1_epi8 ((char) scan->value[n - 1]);
+  __m128i v;
+  int mask;
+
+  for (; to - from >= 16; from += 16)
+    {
+      v = _mm_loadu_si128 ((const __m128i *) (string + from));
+      mask = _mm_movemask_epi8
+	(_mm_or_si128 (_mm_cmpeq_epi8 (_mm_or_si128 (v, m0), v0),
+		       _mm_or_si128 (_mm_cmpeq_epi8 (_mm_or_si128 (v, m1), v1),
+				     _mm_cmpeq_epi8 (_mm_or_si128 (v, m2),
+						     v2))));
+      if (mask)
+	return from + __builtin_ctz (mask);
+    }
+  return from;
+}
+
+/* Likewise for any bytes, looking the low and high nibble of each of 16
+   bytes up in SCAN->lo and SCAN->hi at once; the bytes the tables
+   admit are checked in SCAN->map.  */
+
+static Idx
+scan_fastmap_ssse3 (const re_fastmap_scan_t *scan, const char *string,
+		    Idx from, Idx to)
+{
+  __m128i lo = _mm_loadu_si128 ((const __m128i *) scan->lo);
+  __m128i hi = _mm_loadu_si128 ((const __m128i *) scan->hi);
+  __m128i nibble = _mm_set1_epi8 (0x0f);
+  __m128i v, found;
+  unsigned int mask;
+
+  for (; to - from >= 16; from += 16)
+    {
+      v = _mm_loadu_si128 ((const __m128i *) (string + from));
+      found = _mm_and_si128 (_mm_shuffle_epi8 (lo, _mm_and_si128 (v, nibble)),
+			     _mm_shuffle_epi8 (hi, _mm_and_si128
+					       (_mm_srli_epi16 (v, 4),
+						nibble)));
+      mask = (_mm_movemask_epi8 (_mm_cmpeq_epi8 (found,
+						 _mm_setzero_si128 ()))
+	      ^ 0xffff);
+      for (; mask; mask &= mask - 1)
+	if (scan->map[(unsigned char) string[from + __builtin_ctz (mask)]])
+	  return from + __builtin_ctz (mask);
+    }
+  return from;
+}
+
+/* Likewise 32 bytes at a time.  */
+
+static Idx
+scan_fastmap_avx2 (const re_fastmap_scan_t *scan, const char *string,
+		   Idx from, Idx to)
+{
+  __m128i lo128 = _mm_loadu_si128 ((const __m128i *) scan->lo);
+  __m128i hi128 = _mm_loadu_si128 ((const __m128i *) scan->hi);
+  __m256i lo = _mm256_inserti128_si256 (_mm256_castsi128_si256 (lo128),
+					lo128, 1);
+  __m256i hi = _mm256_inserti128_si256 (_mm256_castsi128_si256 (hi128),
+					hi128, 1);
+  __m256i nibble = _mm256_set1_epi8 (0x0f);
+  __m256i v, found;
+  unsigned int mask;
+
+  for (; to - from >= 32; from += 32)
+    {
+      v = _mm256_loadu_si256 ((const __m256i *) (string + from));
+      found = _mm256_and_si256 (_mm256_shuffle_epi8 (lo, _mm256_and_si256
+						     (v, nibble)),
+				_mm256_shuffle_epi8 (hi, _mm256_and_si256
+						     (_mm256_srli_epi16 (v, 4),
+						      nibble)));
+      mask = ~(unsigned int) _mm256_movemask_epi8
+	(_mm256_cmpeq_epi8 (found, _mm256_setzero_si256 ()));
+      for (; mask; mask &= mask - 1)
+	if (scan->map[(unsigned char) string[from + __builtin_ctz (mask)]])
+	  return from + __builtin_ctz (mask);
+    }
+  return from;
+}
+#endif /* RE_HAVE_SIMD_SCAN */
+
+/* Add the counters STATS of one search to those of DFA.  The caller
+   holds DFA->lock.  */
+
+static void
+merge_match_stats (re_dfa_t *dfa, const reg_stats_t *stats)
+{
+  ++dfa->stats.nsearches;
+  dfa->stats.nbuild_trtable += stats->nbuild_trtable;
+  dfa->stats.fastmap_scanned += stats->fastmap_scanned;
+  dfa->stats.fastmap_skipped += stats->fastmap_skipped;
+  dfa->stats.dfa_bytes += stats->dfa_bytes;
+  dfa->stats.ncheck_matching += stats->ncheck_matching;
+  dfa->stats.nrestarts += stats->nrestarts;
+  dfa->stats.nset_regs += stats->nset_regs;
+  dfa->stats.nsift_states += stats->nsift_states;
+  dfa->stats.literal_skipped += stats->literal_skipped;
+  dfa->stats.nreverse += stats->nreverse;
+  dfa->stats.npure_literal += stats->npure_literal;
+}
+
+/* Return true if the states and transition tables cached by DFA outgrew
+   the budget set by reg_set_dfa_cache_budget.  Those built for
+   REG_DFA_EAGER are never flushed, so they do not count.  */
+
+static bool
+cache_over_budget (const re_dfa_t *dfa)
+{
+  return (dfa->cache_budget != 0
+	  && (dfa->state_bytes + dfa->trtable_bytes
+	      > dfa->cache_budget + dfa->eager_bytes));
+}
+
+/* Flush the cache of DFA, keeping KEEP, if it is over budget and the
+   searches running without DFA->lock are just the NSHARED ones of the
+   caller, who holds the lock.  Otherwise the flush is left pending: new
+   searches take the lock until the last shared one flushes on its way
+   out.  */
+
+static void
+flush_over_budget (const re_dfa_t *dfa, re_dfastate_t *keep, Idx nshared)
+{
+  re_dfa_t *mdfa = (re_dfa_t *) dfa;
+
+  if (__glibc_likely (!cache_over_budget (dfa)))
+    return;
+  /* A search entering now either sees the flag or is counted.  */
+  re_atomic_set (&mdfa->flush_pending, true);
+  if (re_atomic_get (&mdfa->nshared) == nshared)
+    {
+      re_dfa_flush_states (dfa, keep);
+      re_atomic_set (&mdfa->flush_pending, false);
+    }
+}
+
 static reg_errcode_t
 __attribute_warn_unused_result__
 prune_impossible_nodes (re_match_context_t *mctx)
@@ -950,7 +1564,8 @@ prune_impossible_nodes (re_match_context_t *mctx)
 			<= match_last))
     return REG_ESPACE;
 
-  sifted_states = re_malloc (re_dfastate_t *, match_last + 1);
+  sifted_states = re_malloc_tag (re_dfastate_t *, match_last + 1,
+				 REG_MEM_STATE_LOG);
   if (__glibc_unlikely (sifted_states == NULL))
     {
       ret = REG_ESPACE;
@@ -958,7 +1573,8 @@ prune_impossible_nodes (re_match_context_t *mctx)
     }
   if (dfa->nbackref)
     {
-      lim_states = re_malloc (re_dfastate_t *, match_last + 1);
+      lim_states = re_malloc_tag (re_dfastate_t *, match_last + 1,
+				  REG_MEM_STATE_LOG);
       if (__glibc_unlikely (lim_states == NULL))
 	{
 	  ret = REG_ESPACE;
@@ -970,6 +1586,7 @@ prune_impossible_nodes (re_match_context_t *mctx)
 		  sizeof (re_dfastate_t *) * (match_last + 1));
 	  sift_ctx_init (&sctx, sifted_states, lim_states, halt_node,
 			 match_last);
+	  ++mctx->stats.nsift_states;
 	  ret = sift_states_backward (mctx, &sctx);
 	  re_node_set_free (&sctx.limits);
 	  if (__glibc_unlikely (ret != REG_NOERROR))
@@ -1000,6 +1617,7 @@ prune_impossible_nodes (re_match_context_t *mctx)
   else
     {
       sift_ctx_init (&sctx, sifted_states, lim_states, halt_node, match_last);
+      ++mctx->stats.nsift_states;
       ret = sift_states_backward (mctx, &sctx);
       re_node_set_free (&sctx.limits);
       if (__glibc_unlikely (ret != REG_NOERROR))
@@ -1047,9 +1665,15 @@ acquire_init_state_context (reg_errcode_t *err, const re_match_context_t *mctx,
       else if (IS_BEGBUF_CONTEXT (context))
 	{
 	  /* It is relatively rare case, then calculate on demand.  */
-	  return re_acquire_state_context (err, dfa,
-					   dfa->init_state->entrance_nodes,
-					   context);
+	  re_dfastate_t *state;
+	  if (mctx->shared)
+	    lock_lock (((re_dfa_t *) dfa)->lock);
+	  state = re_acquire_state_context (err, dfa,
+					    dfa->init_state->entrance_nodes,
+					    context);
+	  if (mctx->shared)
+	    lock_unlock (((re_dfa_t *) dfa)->lock);
+	  return state;
 	}
       else
 	/* Must not happen?  */
@@ -1134,6 +1758,13 @@ check_matching (re_match_context_t *mctx, bool fl_longest_match,
       re_dfastate_t *old_state = cur_state;
       Idx next_char_idx = re_string_cur_idx (&mctx->input) + 1;
 
+      /* Without a state log only CUR_STATE refers to the cached states,
+	 so the cache may be flushed in the middle of the search.  A
+	 shared search does so in transit_state, under DFA->lock.  */
+      if (mctx->state_log == NULL && !mctx->shared
+	  && __glibc_unlikely (cache_over_budget (dfa)))
+	flush_over_budget (dfa, cur_state, 0);
+
       if ((__glibc_unlikely (next_char_idx >= mctx->input.bufs_len)
 	   && mctx->input.bufs_len < mctx->input.len)
 	  || (__glibc_unlikely (next_char_idx >= mctx->input.valid_len)
@@ -1230,8 +1861,11 @@ check_halt_state_context (const re_match_context_t *mctx,
 #endif
   context = re_string_context_at (&mctx->input, idx, mctx->eflags);
   for (i = 0; i < state->nodes.nelem; ++i)
-    if (check_halt_node_context (mctx->dfa, state->nodes.elems[i], context))
-      return state->nodes.elems[i];
+    {
+      Idx node = re_node_set_elems (&state->nodes)[i];
+      if (check_halt_node_context (mctx->dfa, node, context))
+	return node;
+    }
   return 0;
 }
 
@@ -1260,7 +1894,7 @@ proceed_next_node (const re_match_context_t *mctx, Idx nregs, regmatch_t *regs,
 	 is found.  */
       for (dest_node = -1, i = 0; i < edests->nelem; ++i)
 	{
-	  Idx candidate = edests->elems[i];
+	  Idx candidate = re_node_set_elems (edests)[i];
 	  if (!re_node_set_contains (cur_nodes, candidate))
 	    continue;
           if (dest_node == -1)
@@ -1320,7 +1954,7 @@ proceed_next_node (const re_match_context_t *mctx, Idx nregs, regmatch_t *regs,
 	      ok = re_node_set_insert (eps_via_nodes, node);
 	      if (__glibc_unlikely (! ok))
 		return -2;
-	      dest_node = dfa->edests[node].elems[0];
+	      dest_node = re_node_set_elems (&dfa->edests[node])[0];
 	      if (re_node_set_contains (&mctx->state_log[*pidx]->nodes,
 					dest_node))
 		return dest_node;
@@ -1353,8 +1987,8 @@ push_fail_stack (struct re_fail_stack_t *fs, Idx str_idx, Idx dest_node,
   if (fs->num == fs->alloc)
     {
       struct re_fail_stack_ent_t *new_array;
-      new_array = re_realloc (fs->stack, struct re_fail_stack_ent_t,
-                              fs->alloc * 2);
+      new_array = re_realloc_tag (fs->stack, struct re_fail_stack_ent_t,
+				  fs->alloc * 2, REG_MEM_FAIL_STACK);
       if (new_array == NULL)
 	return REG_ESPACE;
       fs->alloc *= 2;
@@ -1362,7 +1996,7 @@ push_fail_stack (struct re_fail_stack_t *fs, Idx str_idx, Idx dest_node,
     }
   fs->stack[num].idx = str_idx;
   fs->stack[num].node = dest_node;
-  fs->stack[num].regs = re_malloc (regmatch_t, nregs);
+  fs->stack[num].regs = re_malloc_tag (regmatch_t, nregs, REG_MEM_FAIL_STACK);
   if (fs->stack[num].regs == NULL)
     return REG_ESPACE;
   memcpy (fs->stack[num].regs, regs, sizeof (regmatch_t) * nregs);
@@ -1409,7 +2043,8 @@ set_regs (const regex_t *preg, const re_match_context_t *mctx, size_t nmatch,
   if (fl_backtrack)
     {
       fs = &fs_body;
-      fs->stack = re_malloc (struct re_fail_stack_ent_t, fs->alloc);
+      fs->stack = re_malloc_tag (struct re_fail_stack_ent_t, fs->alloc,
+				 REG_MEM_FAIL_STACK);
       if (fs->stack == NULL)
 	return REG_ESPACE;
     }
@@ -1423,7 +2058,8 @@ set_regs (const regex_t *preg, const re_match_context_t *mctx, size_t nmatch,
     prev_idx_match = (regmatch_t *) alloca (nmatch * sizeof (regmatch_t));
   else
     {
-      prev_idx_match = re_malloc (regmatch_t, nmatch);
+      prev_idx_match = re_malloc_tag (regmatch_t, nmatch,
+				      REG_MEM_MATCH_CONTEXT);
       if (prev_idx_match == NULL)
 	{
 	  free_fail_stack_return (fs);
@@ -1435,6 +2071,7 @@ set_regs (const regex_t *preg, const re_match_context_t *mctx, size_t nmatch,
 
   for (idx = pmatch[0].rm_so; idx <= pmatch[0].rm_eo ;)
     {
+      re_trace (SET_REGS, cur_node, idx);
       update_regs (dfa, pmatch, prev_idx_match, cur_node, idx, (Idx)nmatch);
 
       if (idx == pmatch[0].rm_eo && cur_node == mctx->last_node)
@@ -1658,7 +2295,7 @@ build_sifted_states (const re_match_context_t *mctx, re_sift_context_t *sctx,
      (with the epsilon nodes pre-filtered out).  */
   for (i = 0; i < cur_src->nelem; i++)
     {
-      Idx prev_node = cur_src->elems[i];
+      Idx prev_node = re_node_set_elems (cur_src)[i];
       int naccepted = 0;
       bool ok;
 
@@ -1820,7 +2457,8 @@ add_epsilon_src_nodes (const re_dfa_t *dfa, re_node_set *dest_nodes,
       for (i = 0; i < dest_nodes->nelem; i++)
 	{
 	  err = re_node_set_merge (&state->inveclosure,
-				   dfa->inveclosures + dest_nodes->elems[i]);
+				   (dfa->inveclosures
+				    + re_node_set_elems (dest_nodes)[i]));
 	  if (__glibc_unlikely (err != REG_NOERROR))
 	    return REG_ESPACE;
 	}
@@ -1840,14 +2478,14 @@ sub_epsilon_src_nodes (const re_dfa_t *dfa, Idx node, re_node_set *dest_nodes,
     re_node_set_init_empty (&except_nodes);
     for (ecl_idx = 0; ecl_idx < inv_eclosure->nelem; ++ecl_idx)
       {
-	Idx cur_node = inv_eclosure->elems[ecl_idx];
+	Idx cur_node = re_node_set_elems (inv_eclosure)[ecl_idx];
 	if (cur_node == node)
 	  continue;
 	if (IS_EPSILON_NODE (dfa->nodes[cur_node].type))
 	  {
-	    Idx edst1 = dfa->edests[cur_node].elems[0];
+	    Idx edst1 = re_node_set_elems (&dfa->edests[cur_node])[0];
 	    Idx edst2 = ((dfa->edests[cur_node].nelem > 1)
-			 ? dfa->edests[cur_node].elems[1] : -1);
+			 ? re_node_set_elems (&dfa->edests[cur_node])[1] : -1);
 	    if ((!re_node_set_contains (inv_eclosure, edst1)
 		 && re_node_set_contains (dest_nodes, edst1))
 		|| (edst2 > 0
@@ -1866,7 +2504,7 @@ sub_epsilon_src_nodes (const re_dfa_t *dfa, Idx node, re_node_set *dest_nodes,
       }
     for (ecl_idx = 0; ecl_idx < inv_eclosure->nelem; ++ecl_idx)
       {
-	Idx cur_node = inv_eclosure->elems[ecl_idx];
+	Idx cur_node = re_node_set_elems (inv_eclosure)[ecl_idx];
 	if (!re_node_set_contains (&except_nodes, cur_node))
 	  {
 	    Idx idx = re_node_set_contains (dest_nodes, cur_node) - 1;
@@ -1890,13 +2528,15 @@ check_dst_limits (const re_match_context_t *mctx, const re_node_set *limits,
     {
       Idx subexp_idx;
       struct re_backref_cache_entry *ent;
-      ent = mctx->bkref_ents + limits->elems[lim_idx];
+      ent = mctx->bkref_ents + re_node_set_elems (limits)[lim_idx];
       subexp_idx = dfa->nodes[ent->node].opr.idx;
 
-      dst_pos = check_dst_limits_calc_pos (mctx, limits->elems[lim_idx],
+      dst_pos = check_dst_limits_calc_pos (mctx,
+					   re_node_set_elems (limits)[lim_idx],
 					   subexp_idx, dst_node, dst_idx,
 					   dst_bkref_idx);
-      src_pos = check_dst_limits_calc_pos (mctx, limits->elems[lim_idx],
+      src_pos = check_dst_limits_calc_pos (mctx,
+					   re_node_set_elems (limits)[lim_idx],
 					   subexp_idx, src_node, src_idx,
 					   src_bkref_idx);
 
@@ -1924,7 +2564,7 @@ check_dst_limits_calc_pos_1 (const re_match_context_t *mctx, int boundaries,
      closure.  */
   for (node_idx = 0; node_idx < eclosures->nelem; ++node_idx)
     {
-      Idx node = eclosures->elems[node_idx];
+      Idx node = re_node_set_elems (eclosures)[node_idx];
       switch (dfa->nodes[node].type)
 	{
 	case OP_BACK_REF:
@@ -1950,7 +2590,7 @@ check_dst_limits_calc_pos_1 (const re_match_context_t *mctx, int boundaries,
 		     node, don't recurse because it would cause an
 		     infinite loop: a regex that exhibits this behavior
 		     is ()\1*\1*  */
-		  dst = dfa->edests[node].elems[0];
+		  dst = re_node_set_elems (&dfa->edests[node])[0];
 		  if (dst == from_node)
 		    {
 		      if (boundaries & 1)
@@ -2034,7 +2674,7 @@ check_subexp_limits (const re_dfa_t *dfa, re_node_set *dest_nodes,
     {
       Idx subexp_idx;
       struct re_backref_cache_entry *ent;
-      ent = bkref_ents + limits->elems[lim_idx];
+      ent = bkref_ents + re_node_set_elems (limits)[lim_idx];
 
       if (str_idx <= ent->subexp_from || ent->str_idx < str_idx)
 	continue; /* This is unrelated limitation.  */
@@ -2046,7 +2686,7 @@ check_subexp_limits (const re_dfa_t *dfa, re_node_set *dest_nodes,
 	  Idx cls_node = -1;
 	  for (node_idx = 0; node_idx < dest_nodes->nelem; ++node_idx)
 	    {
-	      Idx node = dest_nodes->elems[node_idx];
+	      Idx node = re_node_set_elems (dest_nodes)[node_idx];
 	      re_token_type_t type = dfa->nodes[node].type;
 	      if (type == OP_OPEN_SUBEXP
 		  && subexp_idx == dfa->nodes[node].opr.idx)
@@ -2070,7 +2710,7 @@ check_subexp_limits (const re_dfa_t *dfa, re_node_set *dest_nodes,
 	  if (cls_node >= 0)
 	    for (node_idx = 0; node_idx < dest_nodes->nelem; ++node_idx)
 	      {
-		Idx node = dest_nodes->elems[node_idx];
+		Idx node = re_node_set_elems (dest_nodes)[node_idx];
 		if (!re_node_set_contains (dfa->inveclosures + node,
 					   cls_node)
 		    && !re_node_set_contains (dfa->eclosures + node,
@@ -2090,7 +2730,7 @@ check_subexp_limits (const re_dfa_t *dfa, re_node_set *dest_nodes,
 	{
 	  for (node_idx = 0; node_idx < dest_nodes->nelem; ++node_idx)
 	    {
-	      Idx node = dest_nodes->elems[node_idx];
+	      Idx node = re_node_set_elems (dest_nodes)[node_idx];
 	      re_token_type_t type = dfa->nodes[node].type;
 	      if (type == OP_CLOSE_SUBEXP || type == OP_OPEN_SUBEXP)
 		{
@@ -2130,7 +2770,7 @@ sift_states_bkref (const re_match_context_t *mctx, re_sift_context_t *sctx,
       Idx enabled_idx;
       re_token_type_t type;
       struct re_backref_cache_entry *entry;
-      node = candidates->elems[node_idx];
+      node = re_node_set_elems (candidates)[node_idx];
       type = dfa->nodes[node].type;
       /* Avoid infinite loop for the REs like "()\1+".  */
       if (node == sctx->last_node && str_idx == sctx->last_str_idx)
@@ -2153,7 +2793,7 @@ sift_states_bkref (const re_match_context_t *mctx, re_sift_context_t *sctx,
 	  subexp_len = entry->subexp_to - entry->subexp_from;
 	  to_idx = str_idx + subexp_len;
 	  dst_node = (subexp_len ? dfa->nexts[node]
-		      : dfa->edests[node].elems[0]);
+		      : re_node_set_elems (&dfa->edests[node])[0]);
 
 	  if (to_idx > sctx->last_str_idx
 	      || sctx->sifted_states[to_idx] == NULL
@@ -2267,11 +2907,31 @@ transit_state (reg_errcode_t *err, re_match_context_t *mctx,
   ch = re_string_fetch_byte (&mctx->input);
   for (;;)
     {
-      trtable = state->trtable;
+      trtable = re_atomic_load_acquire (&state->trtable);
       if (__glibc_likely (trtable != NULL))
-	return trtable[ch];
+	return trtable[mctx->dfa->byte_class[ch]];
+
+      if (state->eager_trtable != NULL)
+	{
+	  Idx cls = mctx->dfa->byte_class[ch];
+	  re_state_id_t next;
+	  if (state->eager_word)
+	    {
+	      unsigned int context;
+	      context
+		= re_string_context_at (&mctx->input,
+					re_string_cur_idx (&mctx->input) - 1,
+					mctx->eflags);
+	      if (IS_WORD_CONTEXT (context))
+		cls += mctx->dfa->nbyte_classes;
+	    }
+	  /* A state moved to DFA->eager_block leads to others there, found
+	     by their numbers.  */
+	  next = state->eager_trtable[cls];
+	  return next != 0 ? mctx->dfa->eager_block + next : NULL;
+	}
 
-      trtable = state->word_trtable;
+      trtable = re_atomic_load_acquire (&state->word_trtable);
       if (__glibc_likely (trtable != NULL))
 	{
 	  unsigned int context;
@@ -2280,12 +2940,34 @@ transit_state (reg_errcode_t *err, re_match_context_t *mctx,
 				    re_string_cur_idx (&mctx->input) - 1,
 				    mctx->eflags);
 	  if (IS_WORD_CONTEXT (context))
-	    return trtable[ch + SBC_MAX];
+	    return trtable[mctx->dfa->byte_class[ch]
+			   + mctx->dfa->nbyte_classes];
 	  else
-	    return trtable[ch];
+	    return trtable[mctx->dfa->byte_class[ch]];
 	}
 
-      if (!build_trtable (mctx->dfa, state))
+      ++mctx->stats.nbuild_trtable;
+      re_trace (BUILD_TRTABLE, state->nodes.nelem,
+		re_string_cur_idx (&mctx->input));
+      if (mctx->shared)
+	{
+	  re_dfa_t *dfa = (re_dfa_t *) mctx->dfa;
+	  bool built;
+	  lock_lock (dfa->lock);
+	  /* STATE is the only one this search refers to.  Another search
+	     may have built its table meanwhile.  */
+	  if (__glibc_unlikely (cache_over_budget (dfa)))
+	    flush_over_budget (dfa, state, 1);
+	  built = (state->trtable != NULL || state->word_trtable != NULL
+		   || build_trtable (dfa, state));
+	  lock_unlock (dfa->lock);
+	  if (!built)
+	    {
+	      *err = REG_ESPACE;
+	      return NULL;
+	    }
+	}
+      else if (!build_trtable (mctx->dfa, state))
 	{
 	  *err = REG_ESPACE;
 	  return NULL;
@@ -2419,7 +3101,7 @@ check_subexp_matching_top (re_match_context_t *mctx, re_node_set *cur_nodes,
 	   E.g. RE: (a){2}  */
   for (node_idx = 0; node_idx < cur_nodes->nelem; ++node_idx)
     {
-      Idx node = cur_nodes->elems[node_idx];
+      Idx node = re_node_set_elems (cur_nodes)[node_idx];
       if (dfa->nodes[node].type == OP_OPEN_SUBEXP
 	  && dfa->nodes[node].opr.idx < BITSET_WORD_BITS
 	  && (dfa->used_bkref_map
@@ -2452,7 +3134,7 @@ transit_state_sb (reg_errcode_t *err, re_match_context_t *mctx,
     return NULL;
   for (node_cnt = 0; node_cnt < state->nodes.nelem; ++node_cnt)
     {
-      Idx cur_node = state->nodes.elems[node_cnt];
+      Idx cur_node = re_node_set_elems (&state->nodes)[node_cnt];
       if (check_node_accept (mctx, dfa->nodes + cur_node, cur_str_idx))
 	{
 	  *err = re_node_set_merge (&next_nodes,
@@ -2486,7 +3168,7 @@ transit_state_mb (re_match_context_t *mctx, re_dfastate_t *pstate)
   for (i = 0; i < pstate->nodes.nelem; ++i)
     {
       re_node_set dest_nodes, *new_nodes;
-      Idx cur_node_idx = pstate->nodes.elems[i];
+      Idx cur_node_idx = re_node_set_elems (&pstate->nodes)[i];
       int naccepted;
       Idx dest_idx;
       unsigned int context;
@@ -2558,7 +3240,7 @@ transit_state_bkref (re_match_context_t *mctx, const re_node_set *nodes)
   for (i = 0; i < nodes->nelem; ++i)
     {
       Idx dest_str_idx, prev_nelem, bkc_idx;
-      Idx node_idx = nodes->elems[i];
+      Idx node_idx = re_node_set_elems (nodes)[i];
       unsigned int context;
       const re_token_t *node = dfa->nodes + node_idx;
       re_node_set *new_dest_nodes;
@@ -2597,7 +3279,8 @@ transit_state_bkref (re_match_context_t *mctx, const re_node_set *nodes)
 	    continue;
 	  subexp_len = bkref_ent->subexp_to - bkref_ent->subexp_from;
 	  new_dest_nodes = (subexp_len == 0
-			    ? dfa->eclosures + dfa->edests[node_idx].elems[0]
+			    ? (dfa->eclosures
+			       + re_node_set_elems (&dfa->edests[node_idx])[0])
 			    : dfa->eclosures + dfa->nexts[node_idx]);
 	  dest_str_idx = (cur_str_idx + bkref_ent->subexp_to
 			  - bkref_ent->subexp_from);
@@ -2779,8 +3462,9 @@ get_subexp (re_match_context_t *mctx, Idx bkref_node, Idx bkref_str_idx)
 	    continue; /* No.  */
 	  if (sub_top->path == NULL)
 	    {
-	      sub_top->path = re_calloc (sizeof (state_array_t),
-				      sl_str - sub_top->str_idx + 1);
+	      sub_top->path = re_calloc_tag (sizeof (state_array_t),
+					     sl_str - sub_top->str_idx + 1,
+					     REG_MEM_MATCH_CONTEXT);
 	      if (sub_top->path == NULL)
 		return REG_ESPACE;
 	    }
@@ -2849,7 +3533,7 @@ find_subexp_node (const re_dfa_t *dfa, const re_node_set *nodes,
   Idx cls_idx;
   for (cls_idx = 0; cls_idx < nodes->nelem; ++cls_idx)
     {
-      Idx cls_node = nodes->elems[cls_idx];
+      Idx cls_node = re_node_set_elems (nodes)[cls_idx];
       const re_token_t *node = dfa->nodes + cls_node;
       if (node->type == type
 	  && node->opr.idx == subexp_idx)
@@ -2889,7 +3573,8 @@ check_arrival (re_match_context_t *mctx, state_array_t *path, Idx top_node,
       new_alloc = old_alloc + incr_alloc;
       if (__glibc_unlikely (SIZE_MAX / sizeof (re_dfastate_t *) < new_alloc))
 	return REG_ESPACE;
-      new_array = re_realloc (path->array, re_dfastate_t *, new_alloc);
+      new_array = re_realloc_tag (path->array, re_dfastate_t *, new_alloc,
+				  REG_MEM_MATCH_CONTEXT);
       if (__glibc_unlikely (new_array == NULL))
 	return REG_ESPACE;
       path->array = new_array;
@@ -3044,7 +3729,7 @@ check_arrival_add_next_nodes (re_match_context_t *mctx, Idx str_idx,
   for (cur_idx = 0; cur_idx < cur_nodes->nelem; ++cur_idx)
     {
       int naccepted = 0;
-      Idx cur_node = cur_nodes->elems[cur_idx];
+      Idx cur_node = re_node_set_elems (cur_nodes)[cur_idx];
 #ifdef DEBUG
       re_token_type_t type = dfa->nodes[cur_node].type;
       assert (!IS_EPSILON_NODE (type));
@@ -3127,7 +3812,7 @@ check_arrival_expand_ecl (const re_dfa_t *dfa, re_node_set *cur_nodes,
 
   for (idx = 0; idx < cur_nodes->nelem; ++idx)
     {
-      Idx cur_node = cur_nodes->elems[idx];
+      Idx cur_node = re_node_set_elems (cur_nodes)[idx];
       const re_node_set *eclosure = dfa->eclosures + cur_node;
       outside_node = find_subexp_node (dfa, eclosure, ex_subexp, type);
       if (outside_node == -1)
@@ -3190,13 +3875,13 @@ check_arrival_expand_ecl_sub (const re_dfa_t *dfa, re_node_set *dst_nodes,
       if (dfa->edests[cur_node].nelem == 2)
 	{
 	  reg_errcode_t err;
-	  err = check_arrival_expand_ecl_sub (dfa, dst_nodes,
-					      dfa->edests[cur_node].elems[1],
+	  Idx edest = re_node_set_elems (&dfa->edests[cur_node])[1];
+	  err = check_arrival_expand_ecl_sub (dfa, dst_nodes, edest,
 					      ex_subexp, type);
 	  if (__glibc_unlikely (err != REG_NOERROR))
 	    return err;
 	}
-      cur_node = dfa->edests[cur_node].elems[0];
+      cur_node = re_node_set_elems (&dfa->edests[cur_node])[0];
     }
   return REG_NOERROR;
 }
@@ -3238,7 +3923,7 @@ expand_bkref_cache (re_match_context_t *mctx, re_node_set *cur_nodes,
 	     node in the current state.  */
 	  re_node_set new_dests;
 	  reg_errcode_t err2, err3;
-	  next_node = dfa->edests[ent->node].elems[0];
+	  next_node = re_node_set_elems (&dfa->edests[ent->node])[0];
 	  if (re_node_set_contains (cur_nodes, next_node))
 	    continue;
 	  err = re_node_set_init_1 (&new_dests, next_node);
@@ -3292,8 +3977,8 @@ expand_bkref_cache (re_match_context_t *mctx, re_node_set *cur_nodes,
   return REG_NOERROR;
 }
 
-/* Build transition table for the state.
-   Return true if successful.  */
+/* Build transition table for the state, which has none yet.
+   Return true if successful.  The caller holds DFA->lock.  */
 
 static bool
 build_trtable (const re_dfa_t *dfa, re_dfastate_t *state)
@@ -3311,6 +3996,8 @@ build_trtable (const re_dfa_t *dfa, re_dfastate_t *state)
   re_node_set follows, *dests_node;
   bitset_t *dests_ch;
   bitset_t acceptable;
+  re_node_bitset follow_bits;
+  bool use_bits = dfa->nodes_len <= RE_NODE_BITSET_MAX;
 
   struct dests_alloc
   {
@@ -3326,7 +4013,7 @@ build_trtable (const re_dfa_t *dfa, re_dfastate_t *state)
     dests_alloc = (struct dests_alloc *) alloca (sizeof (struct dests_alloc));
   else
     {
-      dests_alloc = re_malloc (struct dests_alloc, 1);
+      dests_alloc = re_malloc_tag (struct dests_alloc, 1, REG_MEM_TRTABLES);
       if (__glibc_unlikely (dests_alloc == NULL))
 	return false;
       dests_node_malloced = true;
@@ -3334,9 +4021,6 @@ build_trtable (const re_dfa_t *dfa, re_dfastate_t *state)
   dests_node = dests_alloc->dests_node;
   dests_ch = dests_alloc->dests_ch;
 
-  /* Initialize transition table.  */
-  state->word_trtable = state->trtable = NULL;
-
   /* At first, group all nodes belonging to 'state' into several
      destinations.  */
   ndests = group_nodes_into_DFAstates (dfa, state, dests_node, dests_ch);
@@ -3347,10 +4031,18 @@ build_trtable (const re_dfa_t *dfa, re_dfastate_t *state)
       /* Return false in case of an error, true otherwise.  */
       if (ndests == 0)
 	{
-	  state->trtable = (re_dfastate_t **)
-	    re_calloc (sizeof (re_dfastate_t *), SBC_MAX);
-          if (__glibc_unlikely (state->trtable == NULL))
+	  if (re_dfa_check_limit (dfa, 0, (dfa->nbyte_classes
+					   * sizeof (re_dfastate_t *)))
+	      != REG_NOERROR)
+	    return false;
+	  trtable = (re_dfastate_t **)
+	    re_calloc_tag (sizeof (re_dfastate_t *), dfa->nbyte_classes,
+			   REG_MEM_TRTABLES);
+          if (__glibc_unlikely (trtable == NULL))
             return false;
+	  re_dfa_add_size (dfa, 0, (dfa->nbyte_classes
+				    * sizeof (re_dfastate_t *)));
+	  re_atomic_store_release (&state->trtable, trtable);
 	  return true;
 	}
       return false;
@@ -3375,7 +4067,8 @@ build_trtable (const re_dfa_t *dfa, re_dfastate_t *state)
       alloca (ndests * 3 * sizeof (re_dfastate_t *));
   else
     {
-      dest_states = re_malloc (re_dfastate_t *, ndests * 3);
+      dest_states = re_malloc_tag (re_dfastate_t *, ndests * 3,
+				   REG_MEM_TRTABLES);
       if (__glibc_unlikely (dest_states == NULL))
 	{
 out_free:
@@ -3393,23 +4086,46 @@ out_free:
   dest_states_word = dest_states + ndests;
   dest_states_nl = dest_states_word + ndests;
   bitset_empty (acceptable);
+  if (use_bits)
+    re_node_bitset_init (&follow_bits, dfa->nodes_len);
 
   /* Then build the states for all destinations.  */
   for (i = 0; i < ndests; ++i)
     {
       Idx next_node;
+      const re_node_set *added = NULL;
       re_node_set_empty (&follows);
-      /* Merge the follows of this destination states.  */
+      /* Merge the follows of this destination states.  A destination
+	 reached from many branches of a wide alternation has many
+	 follows to merge, so collect them in a bitset if the DFA is
+	 small enough.  */
       for (j = 0; j < dests_node[i].nelem; ++j)
 	{
-	  next_node = dfa->nexts[dests_node[i].elems[j]];
-	  if (next_node != -1)
+	  next_node = dfa->nexts[re_node_set_elems (&dests_node[i])[j]];
+	  if (next_node == -1)
+	    continue;
+	  if (use_bits)
+	    {
+	      /* The branches of a loop all lead back to the same nodes;
+		 skip a follow set equal to the one just added.  */
+	      if (added == NULL
+		  || !re_node_set_compare (added, dfa->eclosures + next_node))
+		re_node_bitset_add (&follow_bits, dfa->eclosures + next_node);
+	      added = dfa->eclosures + next_node;
+	    }
+	  else
 	    {
 	      err = re_node_set_merge (&follows, dfa->eclosures + next_node);
 	      if (__glibc_unlikely (err != REG_NOERROR))
 		goto out_free;
 	    }
 	}
+      if (use_bits)
+	{
+	  err = re_node_bitset_take (&follow_bits, &follows);
+	  if (__glibc_unlikely (err != REG_NOERROR))
+	    goto out_free;
+	}
       dest_states[i] = re_acquire_state_context (&err, dfa, &follows, 0);
       if (__glibc_unlikely (dest_states[i] == NULL && err != REG_NOERROR))
 	goto out_free;
@@ -3444,11 +4160,18 @@ out_free:
       /* We don't care about whether the following character is a word
 	 character, or we are in a single-byte character set so we can
 	 discern by looking at the character code: allocate a
-	 256-entry transition table.  */
-      trtable = state->trtable =
-	(re_dfastate_t **) re_calloc (sizeof (re_dfastate_t *), SBC_MAX);
+	 transition table with an entry per byte class.  */
+      if (re_dfa_check_limit (dfa, 0, (dfa->nbyte_classes
+				       * sizeof (re_dfastate_t *)))
+	  != REG_NOERROR)
+	goto out_free;
+      trtable =
+	(re_dfastate_t **) re_calloc_tag (sizeof (re_dfastate_t *),
+					  dfa->nbyte_classes,
+					  REG_MEM_TRTABLES);
       if (__glibc_unlikely (trtable == NULL))
 	goto out_free;
+      re_dfa_add_size (dfa, 0, dfa->nbyte_classes * sizeof (re_dfastate_t *));
 
       /* For all characters ch...:  */
       for (i = 0; i < BITSET_WORDS; ++i)
@@ -3462,24 +4185,33 @@ out_free:
 	      for (j = 0; (dests_ch[j][i] & mask) == 0; ++j)
 		;
 
-	      /* j-th destination accepts the word character ch.  */
+	      /* j-th destination accepts the word character ch.  The
+		 other bytes of its class get the same state.  */
 	      if (dfa->word_char[i] & mask)
-		trtable[ch] = dest_states_word[j];
+		trtable[dfa->byte_class[ch]] = dest_states_word[j];
 	      else
-		trtable[ch] = dest_states[j];
+		trtable[dfa->byte_class[ch]] = dest_states[j];
 	    }
     }
   else
     {
       /* We care about whether the following character is a word
 	 character, and we are in a multi-byte character set: discern
-	 by looking at the character code: build two 256-entry
-	 transition tables, one starting at trtable[0] and one
-	 starting at trtable[SBC_MAX].  */
-      trtable = state->word_trtable =
-	(re_dfastate_t **) re_calloc (sizeof (re_dfastate_t *), 2 * SBC_MAX);
+	 by looking at the character code: build two transition tables
+	 with an entry per byte class, one starting at trtable[0] and
+	 one starting at trtable[dfa->nbyte_classes].  */
+      if (re_dfa_check_limit (dfa, 0, (2 * dfa->nbyte_classes
+				       * sizeof (re_dfastate_t *)))
+	  != REG_NOERROR)
+	goto out_free;
+      trtable =
+	(re_dfastate_t **) re_calloc_tag (sizeof (re_dfastate_t *),
+					  2 * dfa->nbyte_classes,
+					  REG_MEM_TRTABLES);
       if (__glibc_unlikely (trtable == NULL))
 	goto out_free;
+      re_dfa_add_size (dfa, 0, (2 * dfa->nbyte_classes
+				* sizeof (re_dfastate_t *)));
 
       /* For all characters ch...:  */
       for (i = 0; i < BITSET_WORDS; ++i)
@@ -3494,8 +4226,9 @@ out_free:
 		;
 
 	      /* j-th destination accepts the word character ch.  */
-	      trtable[ch] = dest_states[j];
-	      trtable[ch + SBC_MAX] = dest_states_word[j];
+	      trtable[dfa->byte_class[ch]] = dest_states[j];
+	      trtable[dfa->byte_class[ch] + dfa->nbyte_classes]
+		= dest_states_word[j];
 	    }
     }
 
@@ -3506,16 +4239,25 @@ out_free:
       for (j = 0; j < ndests; ++j)
 	if (bitset_contain (dests_ch[j], NEWLINE_CHAR))
 	  {
-	    /* k-th destination accepts newline character.  */
-	    trtable[NEWLINE_CHAR] = dest_states_nl[j];
+	    /* k-th destination accepts newline character, which is a
+	       byte class by itself.  */
+	    trtable[dfa->byte_class[NEWLINE_CHAR]] = dest_states_nl[j];
 	    if (need_word_trtable)
-	      trtable[NEWLINE_CHAR + SBC_MAX] = dest_states_nl[j];
+	      trtable[dfa->byte_class[NEWLINE_CHAR] + dfa->nbyte_classes]
+		= dest_states_nl[j];
 	    /* There must be only one destination which accepts
 	       newline.  See group_nodes_into_DFAstates.  */
 	    break;
 	  }
     }
 
+  /* Searches that run without DFA->lock may read the table as soon as it
+     is stored, see search_is_shared.  */
+  if (need_word_trtable)
+    re_atomic_store_release (&state->word_trtable, trtable);
+  else
+    re_atomic_store_release (&state->trtable, trtable);
+
   if (dest_states_malloced)
     re_free (dest_states);
 
@@ -3529,6 +4271,84 @@ out_free:
   return true;
 }
 
+/* Build the transition table of every state reachable from the initial
+   states of DFA, for REG_DFA_EAGER.  If more than MAX_STATES states are
+   reachable, or memory runs out, give up and leave the states and tables
+   built so far to the lazy DFA.  Return true if the DFA is complete, in
+   which case the matcher never changes its states.  */
+
+bool
+re_dfa_materialize (re_dfa_t *dfa, Idx max_states)
+{
+  re_dfastate_t **queue, **reallocated;
+  re_dfastate_t *init_states[4];
+  Idx nqueued = 0, i, j, ntrans;
+  size_t eager_bytes = 0;
+
+  queue = re_malloc_tag (re_dfastate_t *, max_states, REG_MEM_DFA_STATES);
+  if (__glibc_unlikely (queue == NULL))
+    return false;
+
+  /* Visit the states breadth first; the MATERIALIZED flag marks those
+     already queued.  */
+  init_states[0] = dfa->init_state;
+  init_states[1] = dfa->init_state_word;
+  init_states[2] = dfa->init_state_nl;
+  init_states[3] = dfa->init_state_begbuf;
+  for (i = 0; i < 4; ++i)
+    if (!init_states[i]->materialized)
+      {
+	init_states[i]->materialized = 1;
+	queue[nqueued++] = init_states[i];
+      }
+
+  for (i = 0; i < nqueued; ++i)
+    {
+      re_dfastate_t *state = queue[i];
+      re_dfastate_t **trtable;
+
+      if (state->trtable == NULL && state->word_trtable == NULL
+	  && !build_trtable (dfa, state))
+	goto give_up;
+      if (state->trtable != NULL)
+	{
+	  trtable = state->trtable;
+	  ntrans = dfa->nbyte_classes;
+	}
+      else
+	{
+	  trtable = state->word_trtable;
+	  ntrans = 2 * dfa->nbyte_classes;
+	}
+      eager_bytes += calc_state_size (state) + calc_trtable_size (dfa, state);
+
+      for (j = 0; j < ntrans; ++j)
+	if (trtable[j] != NULL && !trtable[j]->materialized)
+	  {
+	    if (nqueued == max_states)
+	      goto give_up;
+	    trtable[j]->materialized = 1;
+	    queue[nqueued++] = trtable[j];
+	  }
+    }
+
+  reallocated = re_realloc_tag (queue, re_dfastate_t *, nqueued,
+				REG_MEM_DFA_STATES);
+  if (reallocated != NULL)
+    queue = reallocated;
+  dfa->eager_states = queue;
+  dfa->neager_states = nqueued;
+  dfa->eager_bytes = eager_bytes;
+  dfa->materialized = 1;
+  return true;
+
+ give_up:
+  for (i = 0; i < nqueued; ++i)
+    queue[i]->materialized = 0;
+  re_free (queue);
+  return false;
+}
+
 /* Group all nodes belonging to STATE into several destinations.
    Then for all destinations, set the nodes belonging to the destination
    to DESTS_NODE[i] and set the characters accepted by the destination
@@ -3544,13 +4364,14 @@ group_nodes_into_DFAstates (const re_dfa_t *dfa, const re_dfastate_t *state,
   Idx ndests; /* Number of the destinations from 'state'.  */
   bitset_t accepts; /* Characters a node can accept.  */
   const re_node_set *cur_nodes = &state->nodes;
+  const Idx *cur_elems = re_node_set_elems (cur_nodes);
   bitset_empty (accepts);
   ndests = 0;
 
   /* For all the nodes belonging to 'state',  */
   for (i = 0; i < cur_nodes->nelem; ++i)
     {
-      re_token_t *node = &dfa->nodes[cur_nodes->elems[i]];
+      re_token_t *node = &dfa->nodes[cur_elems[i]];
       re_token_type_t type = node->type;
       unsigned int constraint = node->constraint;
 
@@ -3691,7 +4512,7 @@ group_nodes_into_DFAstates (const re_dfa_t *dfa, const re_dfastate_t *state,
 	    }
 
 	  /* Put the position in the current group. */
-	  ok = re_node_set_insert (&dests_node[j], cur_nodes->elems[i]);
+	  ok = re_node_set_insert (&dests_node[j], cur_elems[i]);
 	  if (__glibc_unlikely (! ok))
 	    goto error_return;
 
@@ -3703,7 +4524,7 @@ group_nodes_into_DFAstates (const re_dfa_t *dfa, const re_dfastate_t *state,
       if (j == ndests)
 	{
 	  bitset_copy (dests_ch[ndests], accepts);
-	  err = re_node_set_init_1 (dests_node + ndests, cur_nodes->elems[i]);
+	  err = re_node_set_init_1 (dests_node + ndests, cur_elems[i]);
 	  if (__glibc_unlikely (err != REG_NOERROR))
 	    goto error_return;
 	  ++ndests;
@@ -4075,6 +4896,8 @@ extend_buffers (re_match_context_t *mctx, int min_len)
   reg_errcode_t ret;
   re_string_t *pstr = &mctx->input;
 
+  re_trace (EXTEND_BUFFERS, pstr->bufs_len, min_len);
+
   /* Avoid overflow.  */
   if (__glibc_unlikely (MIN (IDX_MAX, SIZE_MAX / sizeof (re_dfastate_t *)) / 2
 			<= pstr->bufs_len))
@@ -4093,8 +4916,10 @@ extend_buffers (re_match_context_t *mctx, int min_len)
       /* XXX We have no indication of the size of this buffer.  If this
 	 allocation fail we have no indication that the state_log array
 	 does not have the right size.  */
-      re_dfastate_t **new_array = re_realloc (mctx->state_log, re_dfastate_t *,
-					      pstr->bufs_len + 1);
+      re_dfastate_t **new_array = re_realloc_tag (mctx->state_log,
+						  re_dfastate_t *,
+						  pstr->bufs_len + 1,
+						  REG_MEM_STATE_LOG);
       if (__glibc_unlikely (new_array == NULL))
 	return REG_ESPACE;
       mctx->state_log = new_array;
@@ -4150,8 +4975,10 @@ match_ctx_init (re_match_context_t *mctx, int eflags, Idx n)
       if (__glibc_unlikely (MIN (IDX_MAX, SIZE_MAX / max_object_size) < (size_t)n))
 	return REG_ESPACE;
 
-      mctx->bkref_ents = re_malloc (struct re_backref_cache_entry, n);
-      mctx->sub_tops = re_malloc (re_sub_match_top_t *, n);
+      mctx->bkref_ents = re_malloc_tag (struct re_backref_cache_entry, n,
+					REG_MEM_MATCH_CONTEXT);
+      mctx->sub_tops = re_malloc_tag (re_sub_match_top_t *, n,
+				      REG_MEM_MATCH_CONTEXT);
       if (__glibc_unlikely (mctx->bkref_ents == NULL || mctx->sub_tops == NULL))
 	return REG_ESPACE;
     }
@@ -4221,8 +5048,10 @@ match_ctx_add_entry (re_match_context_t *mctx, Idx node, Idx str_idx, Idx from,
   if (mctx->nbkref_ents >= mctx->abkref_ents)
     {
       struct re_backref_cache_entry* new_entry;
-      new_entry = re_realloc (mctx->bkref_ents, struct re_backref_cache_entry,
-			      mctx->abkref_ents * 2);
+      new_entry = re_realloc_tag (mctx->bkref_ents,
+				  struct re_backref_cache_entry,
+				  mctx->abkref_ents * 2,
+				  REG_MEM_MATCH_CONTEXT);
       if (__glibc_unlikely (new_entry == NULL))
 	{
 	  re_free (mctx->bkref_ents);
@@ -4295,15 +5124,18 @@ match_ctx_add_subtop (re_match_context_t *mctx, Idx node, Idx str_idx)
   if (__glibc_unlikely (mctx->nsub_tops == mctx->asub_tops))
     {
       Idx new_asub_tops = mctx->asub_tops * 2;
-      re_sub_match_top_t **new_array = re_realloc (mctx->sub_tops,
-						   re_sub_match_top_t *,
-						   new_asub_tops);
+      re_sub_match_top_t **new_array = re_realloc_tag (mctx->sub_tops,
+						       re_sub_match_top_t *,
+						       new_asub_tops,
+						       REG_MEM_MATCH_CONTEXT);
       if (__glibc_unlikely (new_array == NULL))
 	return REG_ESPACE;
       mctx->sub_tops = new_array;
       mctx->asub_tops = new_asub_tops;
     }
-  mctx->sub_tops[mctx->nsub_tops] = re_calloc (1, sizeof (re_sub_match_top_t));
+  mctx->sub_tops[mctx->nsub_tops] = re_calloc_tag (1,
+						   sizeof (re_sub_match_top_t),
+						   REG_MEM_MATCH_CONTEXT);
   if (__glibc_unlikely (mctx->sub_tops[mctx->nsub_tops] == NULL))
     return REG_ESPACE;
   mctx->sub_tops[mctx->nsub_tops]->node = node;
@@ -4321,15 +5153,17 @@ match_ctx_add_sublast (re_sub_match_top_t *subtop, Idx node, Idx str_idx)
   if (__glibc_unlikely (subtop->nlasts == subtop->alasts))
     {
       Idx new_alasts = 2 * subtop->alasts + 1;
-      re_sub_match_last_t **new_array = re_realloc (subtop->lasts,
-						    re_sub_match_last_t *,
-						    new_alasts);
+      re_sub_match_last_t **new_array = re_realloc_tag (subtop->lasts,
+							re_sub_match_last_t *,
+							new_alasts,
+							REG_MEM_MATCH_CONTEXT);
       if (__glibc_unlikely (new_array == NULL))
 	return NULL;
       subtop->lasts = new_array;
       subtop->alasts = new_alasts;
     }
-  new_entry = re_calloc (1, sizeof (re_sub_match_last_t));
+  new_entry = re_calloc_tag (1, sizeof (re_sub_match_last_t),
+			     REG_MEM_MATCH_CONTEXT);
   if (__glibc_likely (new_entry != NULL))
     {
       subtop->lasts[subtop->nlasts] = new_entry;
@@ -4368,5 +5202,297 @@ reg_mem_init(
     g_reg_mem.mem_realloc = mem_realloc_fun;
     g_reg_mem.mem_free    = mem_free_fun;
     g_reg_mem.mem_calloc  = mem_calloc_fun;
+    g_reg_mem.mem_malloc_tagged  = NULL;
+    g_reg_mem.mem_realloc_tagged = NULL;
+    g_reg_mem.mem_calloc_tagged  = NULL;
+}
+
+/* Register allocation hooks that also receive the reg_mem_category_t of
+   each request.  */
+
+void
+reg_mem_init_tagged (mem_malloc_tagged_t mem_malloc_fun,
+		     mem_realloc_tagged_t mem_realloc_fun,
+		     mem_free_t mem_free_fun,
+		     mem_calloc_tagged_t mem_calloc_fun)
+{
+  g_reg_mem.mem_malloc = NULL;
+  g_reg_mem.mem_realloc = NULL;
+  g_reg_mem.mem_free = mem_free_fun;
+  g_reg_mem.mem_calloc = NULL;
+  g_reg_mem.mem_malloc_tagged = mem_malloc_fun;
+  g_reg_mem.mem_realloc_tagged = mem_realloc_fun;
+  g_reg_mem.mem_calloc_tagged = mem_calloc_fun;
+}
+
+int
+reg_set_trace (reg_trace_fn fn, void *arg)
+{
+#ifdef RE_ENABLE_TRACE
+  g_reg_trace.fn = fn;
+  g_reg_trace.arg = arg;
+  return REG_NOERROR;
+#else
+  (void) fn;
+  (void) arg;
+  return REG_ENOSYS;
+#endif
+}
+
+/* Copy the matcher counters of PREG to STATS.  */
+
+int
+reg_get_stats (const regex_t *preg, reg_stats_t *stats)
+{
+  re_dfa_t *dfa = preg->buffer;
+
+  if (__glibc_unlikely (dfa == NULL))
+    return REG_BADPAT;
+
+  lock_lock (dfa->lock);
+  *stats = dfa->stats;
+  stats->nstates = dfa->nstates;
+  lock_unlock (dfa->lock);
+  return REG_NOERROR;
+}
+
+void
+reg_reset_stats (regex_t *preg)
+{
+  re_dfa_t *dfa = preg->buffer;
+
+  if (__glibc_unlikely (dfa == NULL))
+    return;
+
+  lock_lock (dfa->lock);
+  memset (&dfa->stats, '\0', sizeof (reg_stats_t));
+  lock_unlock (dfa->lock);
+}
+
+int
+reg_set_dfa_limit (regex_t *preg, size_t max_states, size_t max_trtable_bytes,
+		   reg_dfa_limit_fn fn, void *arg)
+{
+  re_dfa_t *dfa = preg->buffer;
+
+  if (__glibc_unlikely (dfa == NULL))
+    return REG_BADPAT;
+
+  lock_lock (dfa->lock);
+  dfa->max_states = max_states;
+  dfa->max_trtable_bytes = max_trtable_bytes;
+  dfa->limit_fn = fn;
+  dfa->limit_arg = arg;
+  dfa->limit_waived = 0;
+  lock_unlock (dfa->lock);
+  return REG_NOERROR;
+}
+
+int
+reg_set_dfa_cache_budget (regex_t *preg, size_t max_bytes)
+{
+  re_dfa_t *dfa = preg->buffer;
+
+  if (__glibc_unlikely (dfa == NULL || dfa->init_state == NULL))
+    return REG_BADPAT;
+
+  lock_lock (dfa->lock);
+  dfa->cache_budget = max_bytes;
+  flush_over_budget (dfa, NULL, 0);
+  lock_unlock (dfa->lock);
+  return REG_NOERROR;
+}
+
+int
+reg_explain (const regex_t *preg, size_t nmatch, reg_explain_t *explain)
+{
+  const re_dfa_t *dfa = preg->buffer;
+  re_search_plan_t plan;
+  bool use_fastmap;
+
+  if (__glibc_unlikely (dfa == NULL || dfa->init_state == NULL))
+    return REG_BADPAT;
+
+  /* Clip NMATCH as regexec and re_search_internal do.  */
+  if (preg->no_sub)
+    nmatch = 0;
+  else if (nmatch > preg->re_nsub + 1)
+    nmatch = preg->re_nsub + 1;
+  use_fastmap = (preg->fastmap != NULL && preg->fastmap_accurate
+		 && !preg->can_be_null);
+
+  lock_lock (dfa->lock);
+  plan_search (preg, nmatch, use_fastmap, true, &plan);
+  explain->match_kind = plan.match_kind;
+  explain->anchored = plan.anchored;
+  explain->longest_match = plan.fl_longest_match;
+  explain->need_state_log = plan.need_state_log;
+  explain->need_prune = plan.need_prune;
+  explain->need_set_regs = plan.need_set_regs;
+  explain->multibyte = dfa->mb_cur_max > 1;
+  explain->nbackref = dfa->nbackref;
+  explain->nmatch = nmatch;
+  explain->nnodes = dfa->nodes_len;
+  explain->nstates = dfa->nstates;
+  explain->nbyte_classes = dfa->nbyte_classes;
+  explain->materialized = dfa->materialized;
+  explain->lock_free = search_is_shared (preg, nmatch);
+  explain->required_len = plan.use_literal ? dfa->req_len : 0;
+  explain->required_at_start = plan.use_literal && dfa->req_at_start;
+  explain->pure_literal_len = plan.use_pure_literal ? dfa->pure_lit->len : 0;
+  explain->reverse_start = plan.use_reverse && !plan.use_pure_literal;
+  explain->fastmap_width = 1;
+  explain->fastmap_memchr = 0;
+  if ((plan.match_kind == 6 || plan.match_kind == 7)
+      && dfa->fastmap_scan.translate == preg->translate)
+    switch (dfa->fastmap_scan.kind)
+      {
+      case RE_SCAN_MEMCHR:
+	explain->fastmap_memchr = 1;
+	break;
+      case RE_SCAN_WORD:
+	explain->fastmap_width = sizeof (unsigned long);
+	break;
+      case RE_SCAN_SSE2:
+      case RE_SCAN_SSSE3:
+	explain->fastmap_width = 16;
+	break;
+      case RE_SCAN_AVX2:
+	explain->fastmap_width = 32;
+	break;
+      default:
+	break;
+      }
+  lock_unlock (dfa->lock);
+  return REG_NOERROR;
+}
+
+/* Append the string S to TEXT, which holds *LEN bytes.  */
+
+static void
+explain_append (char *text, size_t *len, const char *s)
+{
+  size_t n = strlen (s);
+  memcpy (text + *len, s, n);
+  *len += n;
+}
+
+/* Append the decimal form of NUM to TEXT, which holds *LEN bytes.  */
+
+static void
+explain_append_num (char *text, size_t *len, size_t num)
+{
+  char digits[3 * sizeof (size_t) + 1];
+  char *p = digits + sizeof digits;
+
+  *--p = '\0';
+  do
+    *--p = '0' + num % 10;
+  while ((num /= 10) != 0);
+  explain_append (text, len, p);
+}
+
+size_t
+reg_explain_format (const reg_explain_t *explain, char *buf, size_t size)
+{
+  /* Every line below is short and appears at most once.  */
+  char text[768];
+  size_t len = 0, msg_size;
+  const char *scan;
+
+  switch (explain->match_kind)
+    {
+    case 8:
+      scan = "try every start position";
+      break;
+    case 7:
+      scan = "skip ahead with the fastmap, through the translate table";
+      break;
+    case 6:
+      scan = "skip ahead with the fastmap";
+      break;
+    case 4:
+    case 5:
+      scan = "skip backward with the fastmap";
+      break;
+    default:
+      scan = "skip with the fastmap over the multibyte buffer";
+      break;
+    }
+
+  explain_append (text, &len, "scan: ");
+  explain_append (text, &len, scan);
+  if (explain->fastmap_memchr)
+    explain_append (text, &len, ", with memchr");
+  else if (explain->fastmap_width > 1)
+    {
+      explain_append (text, &len, ", ");
+      explain_append_num (text, &len, explain->fastmap_width);
+      explain_append (text, &len, " bytes at a time");
+    }
+  if (explain->anchored)
+    explain_append (text, &len, ", anchored at the start of the string");
+  if (explain->pure_literal_len)
+    {
+      explain_append (text, &len, "\nliteral: the whole pattern, ");
+      explain_append_num (text, &len, explain->pure_literal_len);
+      explain_append (text, &len, " bytes, searched for without the DFA");
+    }
+  else if (explain->required_len)
+    {
+      explain_append (text, &len, "\nliteral: ");
+      explain_append_num (text, &len, explain->required_len);
+      explain_append (text, &len, explain->required_at_start
+		      ? " bytes every match starts with, searched for first"
+		      : " bytes every match contains, searched for first");
+    }
+  if (explain->reverse_start)
+    explain_append (text, &len, "\nreverse: finds the leftmost start after"
+		    " long failed attempts");
+  explain_append (text, &len, explain->multibyte
+		  ? "\ntext: multibyte characters" : "\ntext: single bytes");
+  explain_append (text, &len, explain->longest_match
+		  ? "\nmatch: longest" : "\nmatch: first found");
+  explain_append (text, &len, "\nregisters: ");
+  explain_append_num (text, &len, explain->nmatch);
+  if (explain->need_state_log)
+    explain_append (text, &len, "\nstate log: kept for every position");
+  if (explain->need_prune)
+    explain_append (text, &len, "\nprune_impossible_nodes: runs after a match");
+  if (explain->need_set_regs)
+    explain_append (text, &len, "\nset_regs: fills the registers");
+  if (explain->nbackref)
+    {
+      explain_append (text, &len, "\nback references: ");
+      explain_append_num (text, &len, explain->nbackref);
+      explain_append (text, &len,
+		      ", resolved with get_subexp and check_arrival");
+    }
+  explain_append (text, &len, "\nNFA nodes: ");
+  explain_append_num (text, &len, explain->nnodes);
+  explain_append (text, &len, "\nDFA states: ");
+  explain_append_num (text, &len, explain->nstates);
+  explain_append (text, &len, "\nbyte classes: ");
+  explain_append_num (text, &len, explain->nbyte_classes);
+  if (explain->materialized)
+    explain_append (text, &len, "\nDFA: built by regcomp");
+  if (explain->lock_free)
+    explain_append (text, &len, "\nlock: taken only to build states");
+  text[len] = '\0';
+
+  msg_size = len + 1; /* Includes the null.  */
+
+  if (__glibc_likely (size != 0))
+    {
+      size_t cpy_size = msg_size;
+      if (__glibc_unlikely (msg_size > size))
+	{
+	  cpy_size = size - 1;
+	  buf[cpy_size] = '\0';
+	}
+      memcpy (buf, text, cpy_size);
+    }
+
+  return msg_size;
 }
 
@@ -0,0 +1,308 @@
+/* Consistency checks of the bookkeeping of the regex library.
+
+   Copyright 2017-2025 Dameng Database Co.,Ltd.
+
+   This file is part of the regex library; it is distributed under the
+   same terms (GNU Lesser General Public License version 2.1 or later).
+
+   The program is not part of the library.  It is built by hand together
+   with the library sources, for example:
+
+     gcc -O2 -Iinclude -o regex_check tests/regex_check.c \
+	 regcomp.c regexec.c regex_internal.c regex.c
+
+   It checks what the matching results do not show:
+
+     mem-usage  between searches, the bytes a compiled pattern (or a
+		shard of it) holds through the reg_mem_init hooks equal
+		the total of reg_get_mem_usage;
+     anchored-exit
+		an anchored pattern searched from past the start, which
+		fails at once, still leaves the search, so that the DFA
+		cache keeps being flushed over its budget;
+
+   and that nothing leaks through the hooks.  Every check prints ok or
+   the reason it failed; the exit status is 1 when any failed.
+
+   Usage: regex_check  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "regex.h"
+
+#define NELEM(a) (sizeof (a) / sizeof ((a)[0]))
+
+/* Memory accounting, as in regex_bench: every block carries a header
+   holding its size, so that the bytes held can be kept exactly.  */
+
+typedef union
+{
+  size_t size;
+  double align_d;
+  void *align_p;
+  long long align_ll;
+} check_mem_hdr;
+
+static size_t check_mem_cur;
+
+static void *
+check_malloc (size_t size)
+{
+  check_mem_hdr *hdr = malloc (sizeof (check_mem_hdr) + size);
+  if (hdr == NULL)
+    return NULL;
+  hdr->size = size;
+  check_mem_cur += size;
+  return hdr + 1;
+}
+
+static void *
+check_realloc (void *ptr, size_t size)
+{
+  check_mem_hdr *hdr;
+  size_t old_size;
+
+  if (ptr == NULL)
+    return check_malloc (size);
+  hdr = (check_mem_hdr *) ptr - 1;
+  old_size = hdr->size;
+  hdr = realloc (hdr, sizeof (check_mem_hdr) + size);
+  if (hdr == NULL)
+    return NULL;
+  hdr->size = size;
+  check_mem_cur = check_mem_cur + size - old_size;
+  return hdr + 1;
+}
+
+static void
+check_free (void *ptr)
+{
+  check_mem_hdr *hdr;
+
+  if (ptr == NULL)
+    return;
+  hdr = (check_mem_hdr *) ptr - 1;
+  check_mem_cur -= hdr->size;
+  free (hdr);
+}
+
+static void *
+check_calloc (int size, size_t n)
+{
+  void *ptr = check_malloc ((size_t) size * n);
+  if (ptr != NULL)
+    memset (ptr, 0, (size_t) size * n);
+  return ptr;
+}
+
+/* mem-usage.  */
+
+static const struct
+{
+  const char *pattern;
+  int cflags;
+} mem_cases[] =
+{
+  { "Shanghai", REG_EXTENDED },
+  { "20[0-9]{2}-(0[1-9]|1[0-2])", REG_EXTENDED },
+  { "pending|cancelled", REG_EXTENDED | REG_ICASE },
+  { "^order-[0-9]+$", REG_EXTENDED | REG_NEWLINE },
+  { "([a-z])\\1", REG_EXTENDED },
+  { "[a-z]+X", REG_EXTENDED },
+  { "\\|(Beijing|Shanghai|Wuhan)\\|[0-9]+\\.",
+    REG_EXTENDED | REG_DFA_EAGER },
+  /* Minimizing merges states of this one.  */
+  { "(paid|shipped|cancelled)", REG_EXTENDED | REG_NOSUB | REG_DFA_EAGER },
+};
+
+static const char *const mem_subjects[] =
+{
+  "ORDER-0000042|user7@example.com|2024-03-05|Shanghai|12.50|paid",
+  "order-17\nPENDING review|Wuhan|3.10|shipped",
+  "aabb ccdd Cancelled by customer",
+  "abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyzX",
+};
+
+/* Return 0 if the bytes held for PREG since BASE are those reported by
+   reg_get_mem_usage, printing the difference otherwise.  */
+
+static int
+check_held (const char *what, const char *pattern, const regex_t *preg,
+	    size_t base)
+{
+  reg_mem_usage_t usage;
+
+  if (reg_get_mem_usage (preg, &usage) != REG_NOERROR)
+    {
+      printf ("  %s /%s/: reg_get_mem_usage failed\n", what, pattern);
+      return -1;
+    }
+  if (usage.total != check_mem_cur - base)
+    {
+      printf ("  %s /%s/: reg_get_mem_usage reports %lu bytes, the hooks"
+	      " hold %lu\n", what, pattern, (unsigned long) usage.total,
+	      (unsigned long) (check_mem_cur - base));
+      return -1;
+    }
+  return 0;
+}
+
+static int
+check_mem_usage (void)
+{
+  regmatch_t pmatch[3];
+  size_t i, j;
+  int ret = 0;
+
+  for (i = 0; i < NELEM (mem_cases); ++i)
+    {
+      const char *pattern = mem_cases[i].pattern;
+      size_t base = check_mem_cur, shard_base;
+      regex_t re, shard;
+
+      if (regcomp (&re, pattern, mem_cases[i].cflags) != 0)
+	{
+	  printf ("  /%s/: regcomp failed\n", pattern);
+	  ret = -1;
+	  continue;
+	}
+      if (check_held ("compiled", pattern, &re, base) != 0)
+	ret = -1;
+      for (j = 0; j < NELEM (mem_subjects); ++j)
+	regexec (&re, mem_subjects[j], NELEM (pmatch), pmatch, 0);
+      if (check_held ("searched", pattern, &re, base) != 0)
+	ret = -1;
+
+      /* A shard reports only what it holds itself.  */
+      shard_base = check_mem_cur;
+      if (reg_dfa_shard (&re, &shard) != REG_NOERROR)
+	{
+	  printf ("  /%s/: reg_dfa_shard failed\n", pattern);
+	  ret = -1;
+	}
+      else
+	{
+	  for (j = 0; j < NELEM (mem_subjects); ++j)
+	    regexec (&shard, mem_subjects[j], NELEM (pmatch), pmatch, 0);
+	  if (check_held ("shard", pattern, &shard, shard_base) != 0)
+	    ret = -1;
+	  regfree (&shard);
+	}
+      regfree (&re);
+    }
+  return ret;
+}
+
+/* anchored-exit.  */
+
+/* Return 0 if two searches of PREG for SUBJECT, over a cache budget of
+   1 byte, flush the cache.  The first one may still flush under its
+   own count, so the second one tells.  */
+
+static int
+check_flushes (const char *what, regex_t *preg, const char *subject)
+{
+  reg_stats_t before, after;
+  regoff_t len = (regoff_t) strlen (subject);
+
+  if (re_search (preg, subject, len, 0, len, NULL) != 0
+      || reg_get_stats (preg, &before) != REG_NOERROR
+      || re_search (preg, subject, len, 0, len, NULL) != 0
+      || reg_get_stats (preg, &after) != REG_NOERROR)
+    {
+      printf ("  %s: search failed\n", what);
+      return -1;
+    }
+  if (after.nflushes == before.nflushes)
+    {
+      printf ("  %s: the cache is no longer flushed\n", what);
+      return -1;
+    }
+  return 0;
+}
+
+static int
+check_anchored_exit (void)
+{
+  static const char pattern[] = "^a[a-z]*q";
+  struct re_pattern_buffer buf;
+  regmatch_t pmatch[1];
+  regex_t re;
+  const char *msg;
+  int ret = 0;
+
+  /* regexec from offset 1 with REG_STARTEND.  */
+  if (regcomp (&re, pattern, REG_EXTENDED) != 0)
+    return -1;
+  reg_set_dfa_cache_budget (&re, 1);
+  pmatch[0].rm_so = 1;
+  pmatch[0].rm_eo = 5;
+  if (regexec (&re, "zabcq", 1, pmatch, REG_STARTEND) != REG_NOMATCH)
+    {
+      printf ("  regexec: matched past the start\n");
+      ret = -1;
+    }
+  else if (check_flushes ("regexec", &re, "abcdefq") != 0)
+    ret = -1;
+  regfree (&re);
+
+  /* re_search from 1.  */
+  memset (&buf, 0, sizeof (buf));
+  re_set_syntax (RE_SYNTAX_POSIX_EXTENDED);
+  msg = re_compile_pattern (pattern, strlen (pattern), &buf);
+  if (msg != NULL)
+    {
+      printf ("  re_compile_pattern failed: %s\n", msg);
+      regfree (&buf);
+      return -1;
+    }
+  reg_set_dfa_cache_budget (&buf, 1);
+  if (re_search (&buf, "zabcq", 5, 1, 4, NULL) != -1)
+    {
+      printf ("  re_search: matched past the start\n");
+      ret = -1;
+    }
+  else if (check_flushes ("re_search", &buf, "abcdefq") != 0)
+    ret = -1;
+  regfree (&buf);
+  return ret;
+}
+
+/* Checks.  */
+
+static const struct
+{
+  const char *name;
+  int (*fn) (void);
+} checks[] =
+{
+  { "mem-usage", check_mem_usage },
+  { "anchored-exit", check_anchored_exit },
+};
+
+int
+main (void)
+{
+  size_t i;
+  int nfailed = 0;
+
+  reg_mem_init (check_malloc, check_realloc, check_free, check_calloc);
+  for (i = 0; i < NELEM (checks); ++i)
+    {
+      int failed = checks[i].fn () != 0;
+      printf ("%-16s %s\n", checks[i].name, failed ? "FAILED" : "ok");
+      nfailed += failed;
+    }
+
+  if (check_mem_cur != 0)
+    {
+      printf ("leaked %lu bytes through reg_mem_init hooks\n",
+	      (unsigned long) check_mem_cur);
+      ++nfailed;
+    }
+  if (nfailed)
+    fprintf (stderr, "%d check(s) FAILED\n", nfailed);
+  return nfailed != 0;
+}